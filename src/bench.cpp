@@ -0,0 +1,441 @@
+// THIRD-PARTY LIBRARIES
+#include <glad/glad.h>
+
+// STANDARD LIBRARIES
+#include <math.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+// OWN CODE
+#include "source.hpp"
+#include "cpu_solver.hpp"
+#include "gpu_solver.hpp"
+#include "egl_context.hpp"
+
+/*
+ * Headless benchmark of the solver kernels. Runs every kernel variant on a
+ * sweep of grid sizes and workgroup shapes, repeats every measurement and
+ * reports the median and best throughput as a table, and optionally as CSV or
+ * JSON for comparison between builds and machines. Needs no display, the GPU
+ * kernels run in an EGL context, on llvmpipe where there is no GPU.
+ * Run it from the repository root, where the shaders are found.
+ */
+
+const int PADDING = 2;
+const float CSQRD = 1.0;
+const float DT = 1.0 / 60.0;
+const float DAMPING = 0.02;
+const float FREQ = 1.5;
+const float AMPLITUDE = 2;
+
+// Kernel variants, set with --kernels.
+enum Kernel {
+    KERNEL_STENCIL, // compute.glsl for 1x1 tiles, compute_tiled.glsl otherwise
+    KERNEL_HALF,    // the same with the heights stored as r16f
+    KERNEL_BLOCKED, // compute_blocked.glsl, TIME_BLOCKS steps per dispatch
+    KERNEL_CPU,     // CpuSolver with the widest instruction set
+    KERNEL_COUNT
+};
+const char* KERNEL_NAMES[KERNEL_COUNT] = { "stencil", "half", "blocked", "cpu" };
+
+std::vector<int> SIZES = { 256, 512, 1024, 2048, 4096, 8192 };
+std::vector<int> TILE_SHAPES = { 1, 1, 8, 8, 16, 16, 32, 8, 8, 32, 32, 32 }; // pairs of width and height
+std::vector<int> TIME_BLOCKS = { 2, 4, 8 };
+bool KERNELS[KERNEL_COUNT] = { true, true, true, true };
+int WARMUP_STEPS = 10;
+// Timed steps per repetition, 0 picks as many as take MIN_SECONDS after the warmup.
+int STEPS = 0;
+double MIN_SECONDS = 0.2;
+int REPEATS = 5;
+int CPU_THREADS = 0;
+const char* CSV_FILE = NULL;
+const char* JSON_FILE = NULL;
+
+struct Result {
+    std::string kernel, shader, device;
+    int width, height, tileWidth, tileHeight, timeBlock;
+    int steps, repeats;
+    double medianSeconds, bestSeconds; // per step
+    double bytesPerCell;               // per step, see cellBytes()
+};
+
+double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+double cellBytes(int heightBytes, int timeBlock) {
+    // Traffic a step has to cause at least: read the latest and the previous
+    // height and write the new one, the neighbours are assumed to hit the cache.
+    // A time block reads and writes both levels once for all of its steps.
+    return timeBlock > 1 ? 4.0 * heightBytes / timeBlock : 3.0 * heightBytes;
+}
+
+double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 == 1 ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+void printUsage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --sizes N,...      grid sides to run (default 256,512,1024,2048,4096,8192)\n");
+    printf("  --tiles WxH,...    workgroup shapes of the GPU kernels (default 1x1,8x8,16x16,32x8,8x32,32x32)\n");
+    printf("  --kernels K,...    variants among stencil, half, blocked and cpu (default all)\n");
+    printf("  --time-blocks K,...  steps per dispatch of the blocked kernel (default 2,4,8)\n");
+    printf("  --warmup N         untimed steps before every measurement (default %d)\n", WARMUP_STEPS);
+    printf("  --steps N          timed steps per repetition (default as many as take %.1f s)\n", MIN_SECONDS);
+    printf("  --min-time S       seconds a repetition takes at least without --steps (default %.1f)\n", MIN_SECONDS);
+    printf("  --repeat N         repetitions of every measurement (default %d)\n", REPEATS);
+    printf("  --cpu-threads N    threads of the cpu kernel (default all cores)\n");
+    printf("  --csv FILE         write the results to FILE as CSV\n");
+    printf("  --json FILE        write the results to FILE as JSON\n");
+    printf("  --help             show this message\n");
+}
+
+bool parseInts(const char* list, std::vector<int>& values) {
+    values.clear();
+    const char* p = list;
+    while (*p != '\0') {
+        char* end;
+        long v = strtol(p, &end, 10);
+        if (end == p || v < 1) {
+            return false;
+        }
+        if (*end != ',' && *end != '\0') {
+            return false;
+        }
+        values.push_back((int) v);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return !values.empty();
+}
+
+bool parseTiles(const char* list, std::vector<int>& shapes) {
+    shapes.clear();
+    std::string s(list);
+    size_t begin = 0;
+    while (begin <= s.size()) {
+        size_t end = s.find(',', begin);
+        if (end == std::string::npos) end = s.size();
+        int w, h;
+        if (sscanf(s.substr(begin, end - begin).c_str(), "%dx%d", &w, &h) != 2 || w < 1 || h < 1) {
+            return false;
+        }
+        shapes.push_back(w);
+        shapes.push_back(h);
+        begin = end + 1;
+    }
+    return true;
+}
+
+bool parseKernels(const char* list) {
+    std::fill(KERNELS, KERNELS + KERNEL_COUNT, false);
+    std::string s(list);
+    size_t begin = 0;
+    while (begin <= s.size()) {
+        size_t end = s.find(',', begin);
+        if (end == std::string::npos) end = s.size();
+        std::string name = s.substr(begin, end - begin);
+        int k = 0;
+        while (k < KERNEL_COUNT && name != KERNEL_NAMES[k]) k++;
+        if (k == KERNEL_COUNT) {
+            return false;
+        }
+        KERNELS[k] = true;
+        begin = end + 1;
+    }
+    return true;
+}
+
+bool parseArguments(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            if (!parseInts(argv[++i], SIZES)) {
+                printf("Invalid grid sizes: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--tiles") == 0 && i + 1 < argc) {
+            if (!parseTiles(argv[++i], TILE_SHAPES)) {
+                printf("Invalid tile shapes: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--kernels") == 0 && i + 1 < argc) {
+            if (!parseKernels(argv[++i])) {
+                printf("Invalid kernels: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--time-blocks") == 0 && i + 1 < argc) {
+            if (!parseInts(argv[++i], TIME_BLOCKS)) {
+                printf("Invalid time blocks: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            WARMUP_STEPS = atoi(argv[++i]);
+            if (WARMUP_STEPS < 1) {
+                printf("Invalid number of warmup steps: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+            STEPS = atoi(argv[++i]);
+            if (STEPS < 1) {
+                printf("Invalid number of steps: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            MIN_SECONDS = atof(argv[++i]);
+            if (MIN_SECONDS <= 0.0) {
+                printf("Invalid time: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            REPEATS = atoi(argv[++i]);
+            if (REPEATS < 1) {
+                printf("Invalid number of repetitions: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--cpu-threads") == 0 && i + 1 < argc) {
+            CPU_THREADS = atoi(argv[++i]);
+            if (CPU_THREADS < 1) {
+                printf("Invalid number of threads: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            CSV_FILE = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            JSON_FILE = argv[++i];
+        } else if (strcmp(argv[i], "--help") == 0) {
+            printUsage(argv[0]);
+            exit(0);
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+int stepsFor(double secondsPerStep, int timeBlock) {
+    // A whole number of blocks, so every timed step runs the measured kernel.
+    int steps = STEPS > 0 ? STEPS : (int) ceil(MIN_SECONDS / std::max(secondsPerStep, 1.0e-9));
+    steps = std::max(steps, 1);
+    return (steps + timeBlock - 1) / timeBlock * timeBlock;
+}
+
+bool benchmarkGpu(Result& r, Kernel kernel, int n, int tileWidth, int tileHeight, int timeBlock) {
+    // Times from an idle GPU until the steps finished. Timer queries would leave
+    // out the driver's submission, but llvmpipe runs the dispatches as they are
+    // submitted and its queries report next to nothing.
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    GpuSolver solver(n, n, PADDING, CSQRD, tileWidth, tileHeight, timeBlock, kernel == KERNEL_HALF);
+    if (glGetError() == GL_OUT_OF_MEMORY) {
+        printf("%-8s %6d %3dx%-4d out of GPU memory\n", KERNEL_NAMES[kernel], n, tileWidth, tileHeight);
+        return false;
+    }
+    if (kernel == KERNEL_BLOCKED && solver.getTimeBlock() != timeBlock) {
+        // Does not fit into shared memory, the solver said why.
+        return false;
+    }
+    SourceTable sources;
+    Source center(&sources, n / 2, n / 2, AMPLITUDE, FREQ);
+
+    auto timeSteps = [&](int steps) {
+        glFinish();
+        double start = now();
+        solver.step(steps, DT, DAMPING, sources);
+        glFinish();
+        return now() - start;
+    };
+    int warmup = (WARMUP_STEPS + timeBlock - 1) / timeBlock * timeBlock;
+    int steps = stepsFor(timeSteps(warmup) / warmup, timeBlock);
+    std::vector<double> perStep;
+    for (int i = 0; i < REPEATS; i++) {
+        perStep.push_back(timeSteps(steps) / steps);
+    }
+
+    r.kernel = KERNEL_NAMES[kernel];
+    r.shader = timeBlock > 1 ? "compute_blocked.glsl" : tileWidth * tileHeight == 1 ? "compute.glsl" : "compute_tiled.glsl";
+    r.device = (const char*) glGetString(GL_RENDERER);
+    r.tileWidth = tileWidth;
+    r.tileHeight = tileHeight;
+    r.timeBlock = timeBlock;
+    r.steps = steps;
+    r.medianSeconds = median(perStep);
+    r.bestSeconds = *std::min_element(perStep.begin(), perStep.end());
+    r.bytesPerCell = cellBytes(kernel == KERNEL_HALF ? 2 : 4, timeBlock);
+    return true;
+}
+
+bool benchmarkCpu(Result& r, int n, int timeBlock) {
+    CpuIsa isa = bestCpuIsa();
+    CpuSolver solver(n, n, PADDING, CSQRD, isa, CPU_THREADS, timeBlock);
+    if (!solver.isValid()) {
+        return false;
+    }
+    SourceTable sources;
+    Source center(&sources, n / 2, n / 2, AMPLITUDE, FREQ);
+
+    auto timeSteps = [&](int steps) {
+        double start = now();
+        solver.step(steps, DT, DAMPING, sources);
+        return now() - start;
+    };
+    // The warmup also faults in the pages and starts the threads.
+    int warmup = (WARMUP_STEPS + timeBlock - 1) / timeBlock * timeBlock;
+    int steps = stepsFor(timeSteps(warmup) / warmup, timeBlock);
+    std::vector<double> perStep;
+    for (int i = 0; i < REPEATS; i++) {
+        perStep.push_back(timeSteps(steps) / steps);
+    }
+
+    char device[64];
+    snprintf(device, sizeof(device), "%s, %d threads", cpuIsaName(isa), solver.getThreads());
+    r.kernel = KERNEL_NAMES[KERNEL_CPU];
+    r.shader = "";
+    r.device = device;
+    r.tileWidth = 0;
+    r.tileHeight = 0;
+    r.timeBlock = solver.getTimeBlock();
+    r.steps = steps;
+    r.medianSeconds = median(perStep);
+    r.bestSeconds = *std::min_element(perStep.begin(), perStep.end());
+    r.bytesPerCell = cellBytes(sizeof(float), timeBlock);
+    return true;
+}
+
+void printResult(const Result& r) {
+    double cells = (double) r.width * r.height;
+    char tile[16] = "-";
+    if (r.tileWidth > 0) snprintf(tile, sizeof(tile), "%dx%d", r.tileWidth, r.tileHeight);
+    printf("%-8s %6d %7s %5d %7d %10.3f %10.1f %10.1f %8.2f\n", r.kernel.c_str(), r.width, tile, r.timeBlock, r.steps,
+            1000.0 * r.medianSeconds, cells / r.medianSeconds / 1e6, cells / r.bestSeconds / 1e6,
+            cells * r.bytesPerCell / r.medianSeconds / 1e9);
+    fflush(stdout);
+}
+
+bool writeCsv(const char* path, const std::vector<Result>& results) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Could not open %s for writing\n", path);
+        return false;
+    }
+    fprintf(file, "kernel,shader,device,width,height,tile_width,tile_height,time_block,steps,repeats,"
+            "ms_per_step,best_ms_per_step,mcells_per_s,best_mcells_per_s,gb_per_s\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        double cells = (double) r.width * r.height;
+        fprintf(file, "%s,%s,\"%s\",%d,%d,%d,%d,%d,%d,%d,%.6f,%.6f,%.3f,%.3f,%.3f\n", r.kernel.c_str(), r.shader.c_str(),
+                r.device.c_str(), r.width, r.height, r.tileWidth, r.tileHeight, r.timeBlock, r.steps, r.repeats,
+                1000.0 * r.medianSeconds, 1000.0 * r.bestSeconds, cells / r.medianSeconds / 1e6,
+                cells / r.bestSeconds / 1e6, cells * r.bytesPerCell / r.medianSeconds / 1e9);
+    }
+    bool ok = fclose(file) == 0;
+    if (!ok) printf("Could not write %s\n", path);
+    return ok;
+}
+
+bool writeJson(const char* path, const std::vector<Result>& results) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Could not open %s for writing\n", path);
+        return false;
+    }
+    fprintf(file, "{\"results\":[");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        double cells = (double) r.width * r.height;
+        fprintf(file, "%s\n{\"kernel\":\"%s\",\"shader\":\"%s\",\"device\":\"%s\",\"width\":%d,\"height\":%d,"
+                "\"tile_width\":%d,\"tile_height\":%d,\"time_block\":%d,\"steps\":%d,\"repeats\":%d,"
+                "\"ms_per_step\":%.6f,\"best_ms_per_step\":%.6f,\"mcells_per_s\":%.3f,\"best_mcells_per_s\":%.3f,\"gb_per_s\":%.3f}",
+                i == 0 ? "" : ",", r.kernel.c_str(), r.shader.c_str(), r.device.c_str(), r.width, r.height,
+                r.tileWidth, r.tileHeight, r.timeBlock, r.steps, r.repeats,
+                1000.0 * r.medianSeconds, 1000.0 * r.bestSeconds, cells / r.medianSeconds / 1e6,
+                cells / r.bestSeconds / 1e6, cells * r.bytesPerCell / r.medianSeconds / 1e9);
+    }
+    fprintf(file, "\n]}\n");
+    bool ok = fclose(file) == 0;
+    if (!ok) printf("Could not write %s\n", path);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    if (!parseArguments(argc, argv)) {
+        return -1;
+    }
+    if (CPU_THREADS == 0) {
+        CPU_THREADS = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    bool gpu = KERNELS[KERNEL_STENCIL] || KERNELS[KERNEL_HALF] || KERNELS[KERNEL_BLOCKED];
+    if (gpu && !createOfflineContext()) {
+        // Still runs the CPU kernel, a missing GPU is no reason to report nothing.
+        printf("Skipping the GPU kernels\n");
+        gpu = false;
+    }
+    int maxInvocations = 0;
+    if (gpu) {
+        glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+        printf("GPU: %s\n", (const char*) glGetString(GL_RENDERER));
+    }
+
+    printf("%-8s %6s %7s %5s %7s %10s %10s %10s %8s\n", "kernel", "grid", "tile", "block", "steps",
+            "ms/step", "Mcells/s", "best", "GB/s");
+    std::vector<Result> results;
+    for (size_t s = 0; s < SIZES.size(); s++) {
+        int n = SIZES[s];
+        Result r;
+        r.width = n;
+        r.height = n;
+        r.repeats = REPEATS;
+        for (int k = 0; k < KERNEL_CPU && gpu; k++) {
+            if (!KERNELS[k]) continue;
+            for (size_t t = 0; t + 1 < TILE_SHAPES.size(); t += 2) {
+                int tw = TILE_SHAPES[t], th = TILE_SHAPES[t + 1];
+                if (tw * th > maxInvocations) {
+                    printf("%-8s %6d %3dx%-4d exceeds GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS (%d)\n",
+                            KERNEL_NAMES[k], n, tw, th, maxInvocations);
+                    continue;
+                }
+                // Blocking shares a tile's halo between steps, single cells have none to share.
+                if (k == KERNEL_BLOCKED && tw * th == 1) continue;
+                std::vector<int> blocks(1, 1);
+                if (k == KERNEL_BLOCKED) blocks = TIME_BLOCKS;
+                for (size_t b = 0; b < blocks.size(); b++) {
+                    if (k == KERNEL_BLOCKED && blocks[b] < 2) continue;
+                    if (benchmarkGpu(r, (Kernel) k, n, tw, th, blocks[b])) {
+                        printResult(r);
+                        results.push_back(r);
+                    }
+                }
+            }
+        }
+        if (KERNELS[KERNEL_CPU]) {
+            std::vector<int> blocks(1, 1);
+            blocks.insert(blocks.end(), TIME_BLOCKS.begin(), TIME_BLOCKS.end());
+            for (size_t b = 0; b < blocks.size(); b++) {
+                if (b > 0 && blocks[b] < 2) continue;
+                if (benchmarkCpu(r, n, blocks[b])) {
+                    printResult(r);
+                    results.push_back(r);
+                }
+            }
+        }
+    }
+
+    bool ok = true;
+    if (CSV_FILE != NULL) ok = writeCsv(CSV_FILE, results) && ok;
+    if (JSON_FILE != NULL) ok = writeJson(JSON_FILE, results) && ok;
+    if (gpu) {
+        destroyOfflineContext();
+    }
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,29 @@
+#ifndef CPU_KERNELS_H
+#define CPU_KERNELS_H
+
+/*
+ * Row kernels of the CPU solver. Every kernel advances the cells [0, n) of a
+ * row in place, exactly like compute.glsl: prev receives the new height.
+ * cur[-1] and cur[n] must be readable, up and down are the rows above and below.
+ * k is csqrd * delta, dampingDelta is damping * delta.
+ * Each kernel lives in its own file compiled for its instruction set, the
+ * scalar kernel is the golden reference. All of them are built with
+ * -ffp-contract=off and evaluate in the same order, so they agree bit for bit.
+ */
+typedef void (*StencilRowKernel)(const float* cur, const float* up, const float* down, float* prev, int n, float k, float dampingDelta);
+
+void stencilRowScalar(const float* cur, const float* up, const float* down, float* prev, int n, float k, float dampingDelta);
+void stencilRowSse41(const float* cur, const float* up, const float* down, float* prev, int n, float k, float dampingDelta);
+void stencilRowAvx2(const float* cur, const float* up, const float* down, float* prev, int n, float k, float dampingDelta);
+void stencilRowAvx512(const float* cur, const float* up, const float* down, float* prev, int n, float k, float dampingDelta);
+
+// Single cell, used by the scalar kernel and for the remainder of the vector kernels.
+// static so every kernel file keeps its own copy compiled for its instruction set.
+static inline float stencilCell(const float* cur, const float* up, const float* down, const float* prev, int i, float k, float dampingDelta) {
+    float h = cur[i];
+    float diff_x = cur[i + 1] - 2.0f * h + cur[i - 1];
+    float diff_y = down[i] - 2.0f * h + up[i];
+    float h_new = 2.0f * h - prev[i] + k * (diff_x + diff_y);
+    return h_new - dampingDelta * (h_new - h);
+}
+#endif
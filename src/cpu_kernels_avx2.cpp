@@ -0,0 +1,23 @@
+#include <immintrin.h>
+
+#include "cpu_kernels.hpp"
+
+// Compiled with -mavx2 (without FMA to stay bit exact), only called when the CPU supports it.
+void stencilRowAvx2(const float* cur, const float* up, const float* down, float* prev, int n, float k, float dampingDelta) {
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 vk = _mm256_set1_ps(k);
+    const __m256 vd = _mm256_set1_ps(dampingDelta);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 h = _mm256_loadu_ps(cur + i);
+        __m256 h2 = _mm256_mul_ps(two, h);
+        __m256 diff_x = _mm256_add_ps(_mm256_sub_ps(_mm256_loadu_ps(cur + i + 1), h2), _mm256_loadu_ps(cur + i - 1));
+        __m256 diff_y = _mm256_add_ps(_mm256_sub_ps(_mm256_loadu_ps(down + i), h2), _mm256_loadu_ps(up + i));
+        __m256 h_new = _mm256_add_ps(_mm256_sub_ps(h2, _mm256_loadu_ps(prev + i)), _mm256_mul_ps(vk, _mm256_add_ps(diff_x, diff_y)));
+        h_new = _mm256_sub_ps(h_new, _mm256_mul_ps(vd, _mm256_sub_ps(h_new, h)));
+        _mm256_storeu_ps(prev + i, h_new);
+    }
+    for (; i < n; i++) {
+        prev[i] = stencilCell(cur, up, down, prev, i, k, dampingDelta);
+    }
+}
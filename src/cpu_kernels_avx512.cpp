@@ -0,0 +1,21 @@
+#include <immintrin.h>
+
+#include "cpu_kernels.hpp"
+
+// Compiled with -mavx512f, only called when the CPU supports it.
+// The remainder of the row is handled with a masked iteration.
+void stencilRowAvx512(const float* cur, const float* up, const float* down, float* prev, int n, float k, float dampingDelta) {
+    const __m512 two = _mm512_set1_ps(2.0f);
+    const __m512 vk = _mm512_set1_ps(k);
+    const __m512 vd = _mm512_set1_ps(dampingDelta);
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = (n - i >= 16) ? (__mmask16) 0xFFFF : (__mmask16) ((1u << (n - i)) - 1);
+        __m512 h = _mm512_maskz_loadu_ps(m, cur + i);
+        __m512 h2 = _mm512_mul_ps(two, h);
+        __m512 diff_x = _mm512_add_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, cur + i + 1), h2), _mm512_maskz_loadu_ps(m, cur + i - 1));
+        __m512 diff_y = _mm512_add_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, down + i), h2), _mm512_maskz_loadu_ps(m, up + i));
+        __m512 h_new = _mm512_add_ps(_mm512_sub_ps(h2, _mm512_maskz_loadu_ps(m, prev + i)), _mm512_mul_ps(vk, _mm512_add_ps(diff_x, diff_y)));
+        h_new = _mm512_sub_ps(h_new, _mm512_mul_ps(vd, _mm512_sub_ps(h_new, h)));
+        _mm512_mask_storeu_ps(prev + i, m, h_new);
+    }
+}
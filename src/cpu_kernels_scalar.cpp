@@ -0,0 +1,7 @@
+#include "cpu_kernels.hpp"
+
+void stencilRowScalar(const float* cur, const float* up, const float* down, float* prev, int n, float k, float dampingDelta) {
+    for (int i = 0; i < n; i++) {
+        prev[i] = stencilCell(cur, up, down, prev, i, k, dampingDelta);
+    }
+}
@@ -0,0 +1,23 @@
+#include <immintrin.h>
+
+#include "cpu_kernels.hpp"
+
+// Compiled with -msse4.1, only called when the CPU supports it.
+void stencilRowSse41(const float* cur, const float* up, const float* down, float* prev, int n, float k, float dampingDelta) {
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 vk = _mm_set1_ps(k);
+    const __m128 vd = _mm_set1_ps(dampingDelta);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 h = _mm_loadu_ps(cur + i);
+        __m128 h2 = _mm_mul_ps(two, h);
+        __m128 diff_x = _mm_add_ps(_mm_sub_ps(_mm_loadu_ps(cur + i + 1), h2), _mm_loadu_ps(cur + i - 1));
+        __m128 diff_y = _mm_add_ps(_mm_sub_ps(_mm_loadu_ps(down + i), h2), _mm_loadu_ps(up + i));
+        __m128 h_new = _mm_add_ps(_mm_sub_ps(h2, _mm_loadu_ps(prev + i)), _mm_mul_ps(vk, _mm_add_ps(diff_x, diff_y)));
+        h_new = _mm_sub_ps(h_new, _mm_mul_ps(vd, _mm_sub_ps(h_new, h)));
+        _mm_storeu_ps(prev + i, h_new);
+    }
+    for (; i < n; i++) {
+        prev[i] = stencilCell(cur, up, down, prev, i, k, dampingDelta);
+    }
+}
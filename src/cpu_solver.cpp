@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "cpu_solver.hpp"
+
+// Columns of a tile. Three rows of the latest heights of this width take 24 KiB and
+// stay in L1 while the tile is swept downwards.
+#define CPU_TILE_COLUMNS 2048
+// Tile of the temporally blocked step. Two time levels of the tile plus a halo of
+// 8 cells take about 600 KiB, which stays in L2 during all substeps.
+#define CPU_BLOCK_ROWS 128
+#define CPU_BLOCK_COLUMNS 512
+
+static const char* ISA_NAMES[CPU_ISA_COUNT] = { "scalar", "sse4.1", "avx2", "avx512" };
+static const StencilRowKernel KERNELS[CPU_ISA_COUNT] = { stencilRowScalar, stencilRowSse41, stencilRowAvx2, stencilRowAvx512 };
+
+const char* cpuIsaName(CpuIsa isa) {
+    return ISA_NAMES[isa];
+}
+
+bool cpuIsaSupported(CpuIsa isa) {
+    __builtin_cpu_init();
+    switch (isa) {
+        case CPU_ISA_SCALAR: return true;
+        case CPU_ISA_SSE41: return __builtin_cpu_supports("sse4.1");
+        case CPU_ISA_AVX2: return __builtin_cpu_supports("avx2");
+        case CPU_ISA_AVX512: return __builtin_cpu_supports("avx512f");
+        default: return false;
+    }
+}
+
+CpuIsa bestCpuIsa() {
+    for (int i = CPU_ISA_COUNT - 1; i > CPU_ISA_SCALAR; i--) {
+        if (cpuIsaSupported((CpuIsa) i)) return (CpuIsa) i;
+    }
+    return CPU_ISA_SCALAR;
+}
+
+bool parseCpuIsa(const char* name, CpuIsa* isa) {
+    for (int i = 0; i < CPU_ISA_COUNT; i++) {
+        if (strcmp(name, ISA_NAMES[i]) == 0) {
+            *isa = (CpuIsa) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+CpuSolver::CpuSolver(int width, int height, int padding, float csqrd, CpuIsa isa, int threads, int timeBlock)
+        : WaveSolver(width, height, padding), pool(threads) {
+    this->csqrd = csqrd;
+    if (!cpuIsaSupported(isa)) {
+        printf("CPU does not support %s, using %s\n", cpuIsaName(isa), cpuIsaName(bestCpuIsa()));
+        isa = bestCpuIsa();
+    }
+    this->isa = isa;
+    kernel = KERNELS[isa];
+    this->timeBlock = std::max(1, timeBlock);
+    // The blocked step needs two more buffers to write into.
+    bufferCount = this->timeBlock > 1 ? 4 : 2;
+    blockScratch.resize(pool.size());
+    // The pages are left untouched here and first written by the threads owning them.
+    valid = true;
+    for (int i = 0; i < bufferCount; i++) {
+        void* memory = NULL;
+        if (posix_memalign(&memory, 64, (size_t) stride * getRows() * sizeof(float)) != 0) {
+            printf("Could not allocate the CPU solver heights for %dx%d cells\n", width, height);
+            memory = NULL;
+            valid = false;
+        }
+        heights[i] = (float*) memory;
+    }
+    latest = 0;
+    reset();
+}
+
+CpuSolver::~CpuSolver() {
+    for (int i = 0; i < bufferCount; i++) {
+        free(heights[i]);
+    }
+}
+
+void CpuSolver::band(int thread, int* begin, int* end) const {
+    int threads = pool.size();
+    *begin = padding + (int) ((long) height * thread / threads);
+    *end = padding + (int) ((long) height * (thread + 1) / threads);
+    if (thread == 0) *begin = 0;
+    if (thread == threads - 1) *end = getRows();
+}
+
+void CpuSolver::clearBand(int thread) {
+    int begin, end;
+    band(thread, &begin, &end);
+    for (int i = 0; i < bufferCount; i++) {
+        memset(heights[i] + (size_t) begin * stride, 0, (size_t) (end - begin) * stride * sizeof(float));
+    }
+}
+
+void CpuSolver::reset() {
+    if (!valid) {
+        return;
+    }
+    pool.run([this](int thread) { clearBand(thread); });
+    sourceStates.clear();
+}
+
+void CpuSolver::readHeights(bool latest, std::vector<float>& out) {
+    const float* h = hostHeights(latest);
+    out.assign(h, h + (size_t) stride * getRows());
+}
+
+bool CpuSolver::inside(const SourceParams& p) const {
+    return p.x >= 0 && p.y >= 0 && p.x < width && p.y < height;
+}
+
+float CpuSolver::advanceSource(const SourceParams& p, SourceState& s, float delta, float damping) const {
+    // Same update as source_inject.glsl for a single step, returns the height added to the source cell.
+    if (s.epoch != p.epoch) {
+        s.phase = p.phase;
+        s.epoch = p.epoch;
+    }
+    s.phase += delta;
+    s.amplitude = p.amplitude + (s.amplitude - p.amplitude) * std::max(1.0f - (float) SOURCE_AMP_RESPONSE_RATE * delta, 0.0f);
+    return csqrd * delta * sinf(s.phase * p.freq) * s.amplitude * (1.0f - damping * delta);
+}
+
+void CpuSolver::advanceSources(const SourceTable& sources, float* h, int rowBegin, int rowEnd, bool outside, float delta, float damping) {
+    // Advances the sources in rows [rowBegin, rowEnd) and injects them, optionally
+    // also advancing those outside of the simulation.
+    for (int i = 0; i < sources.size(); i++) {
+        const SourceParams& p = sources.get(i);
+        int row = p.y + padding;
+        if (inside(p) ? (row < rowBegin || row >= rowEnd) : !outside) {
+            continue;
+        }
+        float term = advanceSource(p, sourceStates[i], delta, damping);
+        if (inside(p)) {
+            h[(size_t) row * stride + p.x + padding] += term;
+        }
+    }
+}
+
+void CpuSolver::step(int steps, float delta, float damping, SourceTable& sources) {
+    if ((int) sourceStates.size() < sources.size()) {
+        sourceStates.resize(sources.size(), SourceState {0.0f, 0.0f, 0, 0.0f});
+    }
+    // Whole blocks of timeBlock steps are fused, the rest is swept one step at a time.
+    if (timeBlock > 1) {
+        for (; steps >= timeBlock; steps -= timeBlock) {
+            blockStep(delta, damping, sources);
+        }
+    }
+    if (steps == 0) {
+        return;
+    }
+    float k = csqrd * delta;
+    float dampingDelta = damping * delta;
+    int first = latest;
+    pool.run([&](int thread) {
+        int begin, end;
+        band(thread, &begin, &end);
+        // Only the rows of the simulation are updated, the padding stays zero.
+        int rowBegin = std::max(begin, padding), rowEnd = std::min(end, padding + height);
+        int cur = first;
+        for (int s = 0; s < steps; s++) {
+            const float* h = heights[cur];
+            float* prev = heights[1 - cur];
+            for (int x = 0; x < width; x += CPU_TILE_COLUMNS) {
+                int n = std::min(CPU_TILE_COLUMNS, width - x);
+                for (int y = rowBegin; y < rowEnd; y++) {
+                    size_t row = (size_t) y * stride + padding + x;
+                    kernel(h + row, h + row - stride, h + row + stride, prev + row, n, k, dampingDelta);
+                }
+            }
+            cur = 1 - cur;
+            // Sources only change cells of the own band, which the neighbours read after the barrier.
+            advanceSources(sources, heights[cur], rowBegin, rowEnd, thread == 0, delta, damping);
+            pool.barrier();
+        }
+    });
+    latest = (first + steps) % 2;
+}
+
+void CpuSolver::blockStep(float delta, float damping, const SourceTable& sources) {
+    // Ghost zone temporal blocking, the CPU counterpart of compute_blocked.glsl.
+    // Every tile is copied with a halo of timeBlock cells into a private scratch
+    // buffer and advanced timeBlock steps there. The valid region shrinks by one
+    // cell per substep, after the last one exactly the tile is written to the
+    // spare buffers. Halos overlap, so neighbouring tiles redo some work, but the
+    // heights only travel to memory and back once per block.
+    int depth = timeBlock;
+    int count = sources.size();
+    // The source terms of every substep are computed up front in the same order as
+    // the unblocked step, which keeps both bit for bit identical.
+    sourceTerms.resize((size_t) count * depth);
+    for (int s = 0; s < depth; s++) {
+        for (int i = 0; i < count; i++) {
+            sourceTerms[(size_t) i * depth + s] = advanceSource(sources.get(i), sourceStates[i], delta, damping);
+        }
+    }
+
+    float k = csqrd * delta;
+    float dampingDelta = damping * delta;
+    int tileColumns = (width + CPU_BLOCK_COLUMNS - 1) / CPU_BLOCK_COLUMNS;
+    int tiles = tileColumns * ((height + CPU_BLOCK_ROWS - 1) / CPU_BLOCK_ROWS);
+    const float* in[2] = { heights[latest], heights[1 - latest] };
+    float* out[2] = { heights[2], heights[3] };
+
+    pool.run([&](int thread) {
+        int regionWidth = CPU_BLOCK_COLUMNS + 2 * depth;
+        std::vector<float>& scratch = blockScratch[thread];
+        scratch.resize((size_t) 2 * regionWidth * (CPU_BLOCK_ROWS + 2 * depth));
+        std::vector<int> tileSources;
+
+        // Consecutive tiles per thread, which roughly follow the bands touched by the thread.
+        int threads = pool.size();
+        for (int t = (int) ((long) tiles * thread / threads); t < (int) ((long) tiles * (thread + 1) / threads); t++) {
+            int y0 = padding + (t / tileColumns) * CPU_BLOCK_ROWS;
+            int x0 = padding + (t % tileColumns) * CPU_BLOCK_COLUMNS;
+            int y1 = std::min(y0 + CPU_BLOCK_ROWS, padding + height);
+            int x1 = std::min(x0 + CPU_BLOCK_COLUMNS, padding + width);
+            // Tile plus halo, clipped to the padded grid.
+            int ry0 = std::max(y0 - depth, 0), ry1 = std::min(y1 + depth, getRows());
+            int rx0 = std::max(x0 - depth, 0), rx1 = std::min(x1 + depth, stride);
+            int w = rx1 - rx0;
+            float* level[2] = { scratch.data(), scratch.data() + scratch.size() / 2 };
+            for (int y = ry0; y < ry1; y++) {
+                memcpy(level[0] + (size_t) (y - ry0) * w, in[0] + (size_t) y * stride + rx0, w * sizeof(float));
+                memcpy(level[1] + (size_t) (y - ry0) * w, in[1] + (size_t) y * stride + rx0, w * sizeof(float));
+            }
+
+            tileSources.clear();
+            for (int i = 0; i < count; i++) {
+                const SourceParams& p = sources.get(i);
+                int row = p.y + padding, column = p.x + padding;
+                if (inside(p) && row >= ry0 && row < ry1 && column >= rx0 && column < rx1) {
+                    tileSources.push_back(i);
+                }
+            }
+
+            int cur = 0;
+            for (int s = 1; s <= depth; s++) {
+                // Cells whose neighbours were valid in the last substep, the padding stays zero.
+                int uy0 = std::max(y0 - depth + s, padding), uy1 = std::min(y1 + depth - s, padding + height);
+                int ux0 = std::max(x0 - depth + s, padding), ux1 = std::min(x1 + depth - s, padding + width);
+                for (int y = uy0; y < uy1; y++) {
+                    size_t offset = (size_t) (y - ry0) * w + (ux0 - rx0);
+                    kernel(level[cur] + offset, level[cur] + offset - w, level[cur] + offset + w, level[1 - cur] + offset,
+                            ux1 - ux0, k, dampingDelta);
+                }
+                cur = 1 - cur;
+                for (size_t i = 0; i < tileSources.size(); i++) {
+                    const SourceParams& p = sources.get(tileSources[i]);
+                    int row = p.y + padding, column = p.x + padding;
+                    if (row >= uy0 && row < uy1 && column >= ux0 && column < ux1) {
+                        level[cur][(size_t) (row - ry0) * w + column - rx0] += sourceTerms[(size_t) tileSources[i] * depth + s - 1];
+                    }
+                }
+            }
+
+            for (int y = y0; y < y1; y++) {
+                memcpy(out[0] + (size_t) y * stride + x0, level[cur] + (size_t) (y - ry0) * w + (x0 - rx0), (x1 - x0) * sizeof(float));
+                memcpy(out[1] + (size_t) y * stride + x0, level[1 - cur] + (size_t) (y - ry0) * w + (x0 - rx0), (x1 - x0) * sizeof(float));
+            }
+        }
+    });
+    std::swap(heights[latest], heights[2]);
+    std::swap(heights[1 - latest], heights[3]);
+}
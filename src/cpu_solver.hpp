@@ -0,0 +1,97 @@
+#include <vector>
+
+#include "source.hpp"
+#include "wave_solver.hpp"
+#include "cpu_kernels.hpp"
+#include "thread_pool.hpp"
+
+#ifndef CPU_SOLVER_H
+#define CPU_SOLVER_H
+
+enum CpuIsa {
+    CPU_ISA_SCALAR,
+    CPU_ISA_SSE41,
+    CPU_ISA_AVX2,
+    CPU_ISA_AVX512,
+    CPU_ISA_COUNT
+};
+
+const char* cpuIsaName(CpuIsa isa);
+bool cpuIsaSupported(CpuIsa isa);
+// Widest instruction set supported by this CPU.
+CpuIsa bestCpuIsa();
+// Parses a name as printed by cpuIsaName, returns false for unknown names.
+bool parseCpuIsa(const char* name, CpuIsa* isa);
+
+/*
+ * CPU implementation of the GPU solver: the step of compute.glsl followed by
+ * the source update and injection of source_inject.glsl.
+ * Heights are stored like the GPU textures, a width x height grid surrounded
+ * by padding cells which stay zero and form the boundary.
+ * The rows are split into one band per thread of a persistent pool. A band is
+ * swept in tiles of CPU_TILE_COLUMNS columns, so the three rows read by the
+ * stencil stay in L1, and the threads meet at a barrier after every step.
+ * Every band is first touched by the thread which updates it.
+ * With a time block above one, that many steps are fused per pass over memory,
+ * see blockStep().
+ */
+class CpuSolver : public WaveSolver {
+    float csqrd;
+    // Latest and previous heights, the step writes the new heights over the previous ones.
+    // The blocked step writes into the spares at index 2 and 3.
+    float* heights[4];
+    int bufferCount;
+    bool valid; // false when the heights could not be allocated
+    int latest;
+    int timeBlock;
+    std::vector<std::vector<float> > blockScratch; // per thread
+    std::vector<float> sourceTerms; // per source and substep of a block
+    std::vector<SourceState> sourceStates;
+    CpuIsa isa;
+    StencilRowKernel kernel;
+    ThreadPool pool;
+
+    // Rows [begin, end) of the padded grid owned by a thread, including the padding rows at the edges.
+    void band(int thread, int* begin, int* end) const;
+    void clearBand(int thread);
+    bool inside(const SourceParams& p) const;
+    float advanceSource(const SourceParams& p, SourceState& s, float delta, float damping) const;
+    void advanceSources(const SourceTable& sources, float* h, int rowBegin, int rowEnd, bool outside, float delta, float damping);
+    void blockStep(float delta, float damping, const SourceTable& sources);
+    public:
+        CpuSolver(int width, int height, int padding, float csqrd, CpuIsa isa, int threads = 1, int timeBlock = 1);
+        ~CpuSolver();
+        CpuSolver(const CpuSolver&) = delete;
+        CpuSolver& operator=(const CpuSolver&) = delete;
+
+        const char* name() const {
+            return "cpu";
+        }
+        // Whether the heights could be allocated, the solver must not be used otherwise.
+        bool isValid() const {
+            return valid;
+        }
+        void step(int steps, float delta, float damping, SourceTable& sources);
+        void reset();
+        void readHeights(bool latest, std::vector<float>& out);
+        const float* hostHeights(bool latest) const {
+            return latest ? latestHeights() : previousHeights();
+        }
+
+        const float* latestHeights() const {
+            return heights[latest];
+        }
+        const float* previousHeights() const {
+            return heights[1 - latest];
+        }
+        CpuIsa getIsa() const {
+            return isa;
+        }
+        int getThreads() const {
+            return pool.size();
+        }
+        int getTimeBlock() const {
+            return timeBlock;
+        }
+};
+#endif
@@ -0,0 +1,12 @@
+#ifndef EGL_CONTEXT_H
+#define EGL_CONTEXT_H
+
+/*
+ * OpenGL 4.5 core context without a window, used by the offline mode.
+ * Prefers the surfaceless platform of Mesa, which needs neither a display
+ * server nor a GPU and so also runs on llvmpipe. Rendering has to go to
+ * framebuffer objects. Loads the GL functions with glad.
+ */
+bool createOfflineContext();
+void destroyOfflineContext();
+#endif
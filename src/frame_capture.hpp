@@ -0,0 +1,209 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <glad/glad.h>
+#include <time.h>
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+
+#include "shader.hpp"
+
+// Layout of a captured frame, both top row first.
+enum CaptureFormat {
+    CAPTURE_RGB,   // tightly packed RGB24 rows
+    CAPTURE_YUV420 // planar I420: Y, then U and V at half width and height (rounded up)
+};
+
+/*
+ * Asynchronous readback of rendered frames through a ring of pixel buffer
+ * objects. capture() only queues the copy of the read framebuffer, converts
+ * it into the next buffer with frame_convert.glsl and fences it, the pixels
+ * are mapped once the fence signaled, usually two frames later. So the render
+ * thread never waits for the GPU, and YUV420 frames only move half the bytes
+ * of RGB across the bus.
+ * When every buffer is still in flight the new frame is either dropped or,
+ * when no frame may be lost, the oldest one is waited for.
+ */
+class FrameCapture {
+    struct Slot {
+        unsigned int pbo;
+        GLsync fence;
+        long frame;
+        double submitted; // seconds
+    };
+    int width, height;
+    CaptureFormat format;
+    size_t frameSize;
+    bool dropWhenFull;
+    ComputeShader* convertShader;
+    unsigned int pixels; // RGBA as read from the framebuffer, stays on the GPU
+    std::vector<Slot> slots;
+    int head;    // slot which receives the next frame
+    int pending; // frames in flight, the oldest one at head - pending
+    long lastFrame;
+    long captured, dropped;
+    double latencySum, latencyMax; // seconds
+    long latencyFramesSum;
+
+    static double now() {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec + 1.0e-9 * t.tv_nsec;
+    }
+
+    // Hands the oldest frame in flight to the sink. Without wait it is left
+    // alone if the GPU has not finished it yet.
+    template <class F>
+    bool deliverOldest(F& sink, bool wait) {
+        Slot& s = slots[(head - pending + slots.size()) % slots.size()];
+        GLenum status = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while (wait && status == GL_TIMEOUT_EXPIRED) {
+            status = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        }
+        if (status == GL_TIMEOUT_EXPIRED) {
+            return false;
+        }
+        glDeleteSync(s.fence);
+        s.fence = 0;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+        const unsigned char* data = (const unsigned char*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameSize, GL_MAP_READ_BIT);
+        sink(s.frame, data, frameSize);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        double latency = now() - s.submitted;
+        latencySum += latency;
+        latencyMax = std::max(latencyMax, latency);
+        latencyFramesSum += lastFrame - s.frame;
+        captured++;
+        pending--;
+        return true;
+    }
+    public:
+        FrameCapture(int width, int height, CaptureFormat format = CAPTURE_RGB, int slotCount = 3, bool dropWhenFull = true) {
+            this->width = width;
+            this->height = height;
+            this->format = format;
+            this->dropWhenFull = dropWhenFull;
+            frameSize = format == CAPTURE_YUV420
+                ? (size_t) width * height + 2 * (size_t) ((width + 1) / 2) * ((height + 1) / 2)
+                : (size_t) width * height * 3;
+            convertShader = new ComputeShader("./src/shaders/compute/frame_convert.glsl",
+                    format == CAPTURE_YUV420 ? "#define YUV420\n" : "");
+            convertShader->use();
+            convertShader->setVec2i("size", width, height);
+
+            glGenBuffers(1, &pixels);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pixels);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (size_t) width * height * 4, NULL, GL_STREAM_COPY);
+            slots.resize(std::max(slotCount, 1));
+            for (size_t i = 0; i < slots.size(); i++) {
+                glGenBuffers(1, &slots[i].pbo);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[i].pbo);
+                // The shader writes whole words.
+                glBufferData(GL_PIXEL_PACK_BUFFER, (frameSize + 3) / 4 * 4, NULL, GL_STREAM_READ);
+                slots[i].fence = 0;
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            head = 0;
+            pending = 0;
+            lastFrame = 0;
+            captured = 0;
+            dropped = 0;
+            latencySum = 0.0;
+            latencyMax = 0.0;
+            latencyFramesSum = 0;
+        }
+        ~FrameCapture() {
+            for (size_t i = 0; i < slots.size(); i++) {
+                if (slots[i].fence != 0) {
+                    glDeleteSync(slots[i].fence);
+                }
+                glDeleteBuffers(1, &slots[i].pbo);
+            }
+            glDeleteBuffers(1, &pixels);
+            delete convertShader;
+        }
+        FrameCapture(const FrameCapture&) = delete;
+        FrameCapture& operator=(const FrameCapture&) = delete;
+
+        // Queues the readback of the bound read framebuffer as the given frame and
+        // calls sink(frame, pixels, size) for every earlier frame which arrived meanwhile.
+        // Returns false if the frame was dropped.
+        template <class F>
+        bool capture(long frame, F sink) {
+            lastFrame = frame;
+            poll(sink);
+            if (pending == (int) slots.size()) {
+                if (dropWhenFull) {
+                    dropped++;
+                    return false;
+                }
+                deliverOldest(sink, true);
+            }
+            Slot& s = slots[head];
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pixels);
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            convertShader->use();
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, pixels);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, s.pbo);
+            glDispatchCompute((unsigned int) ((frameSize + 4 * 64 - 1) / (4 * 64)), 1, 1);
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+            s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            s.frame = frame;
+            s.submitted = now();
+            head = (head + 1) % slots.size();
+            pending++;
+            return true;
+        }
+
+        // Hands every frame which already arrived to the sink, oldest first.
+        template <class F>
+        void poll(F sink) {
+            while (pending > 0 && deliverOldest(sink, false)) {
+            }
+        }
+
+        // Waits for all frames in flight and hands them to the sink.
+        template <class F>
+        void finish(F sink) {
+            while (pending > 0) {
+                deliverOldest(sink, true);
+            }
+        }
+
+        int getWidth() const {
+            return width;
+        }
+        int getHeight() const {
+            return height;
+        }
+        CaptureFormat getFormat() const {
+            return format;
+        }
+        size_t getFrameSize() const {
+            return frameSize;
+        }
+        long getCaptured() const {
+            return captured;
+        }
+        long getDropped() const {
+            return dropped;
+        }
+        // Average and worst time from capture() until the pixels were handed over, in seconds.
+        double averageLatency() const {
+            return captured > 0 ? latencySum / captured : 0.0;
+        }
+        double maxLatency() const {
+            return latencyMax;
+        }
+        // Average number of frames captured after a frame until it was handed over.
+        double averageLatencyFrames() const {
+            return captured > 0 ? (double) latencyFramesSum / captured : 0.0;
+        }
+};
+#endif
@@ -0,0 +1,130 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <time.h>
+#include <math.h>
+#include <algorithm>
+
+/*
+ * Paces the render loop to a fixed frame period without burning a core.
+ * wait() sleeps until shortly before the next deadline and spins for the
+ * remainder, as sleeps may wake up late by the scheduler's slack. The margin
+ * left for spinning follows the worst recent oversleep, so a quiet machine
+ * hardly spins at all. The sleep can be replaced, e.g. by a wait for window
+ * events, so input is handled while idle. With a period of 0 it does not wait
+ * at all, for when the swap blocks on vsync instead.
+ * Frame intervals are measured either way to report the jitter.
+ */
+class FramePacer {
+    double period;     // seconds, 0 leaves pacing to the swap
+    double oversleep;  // worst recent time a sleep overran, decays slowly
+    double spinMargin; // seconds before the deadline at which sleeping stops
+    double deadline;
+    double lastFrame;
+    long frames, missed;
+    double intervalSum, intervalSquaredSum, worstDeviation;
+    double lateSum; // how late frames started after their deadline, summed
+
+    static double now() {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec + 1.0e-9 * t.tv_nsec;
+    }
+
+    static void sleepFor(double seconds) {
+        struct timespec t;
+        t.tv_sec = (time_t) seconds;
+        t.tv_nsec = (long) ((seconds - t.tv_sec) * 1.0e9);
+        nanosleep(&t, NULL);
+    }
+    public:
+        FramePacer(double period) {
+            this->period = period;
+            oversleep = 0.001;
+            spinMargin = 0.002;
+            lastFrame = now();
+            deadline = lastFrame + period;
+            frames = 0;
+            missed = 0;
+            intervalSum = 0.0;
+            intervalSquaredSum = 0.0;
+            worstDeviation = 0.0;
+            lateSum = 0.0;
+        }
+
+        // Waits until the next frame is due and returns the seconds since the
+        // previous one started. sleep(seconds) may return early.
+        template <class F>
+        double wait(F sleep) {
+            if (period > 0.0) {
+                double remaining = deadline - now();
+                while (remaining > spinMargin) {
+                    double before = now();
+                    sleep(remaining - spinMargin);
+                    double after = now();
+                    // Sleeps which ended early, e.g. for an event, tell nothing.
+                    double overran = (after - before) - (remaining - spinMargin);
+                    if (overran > 0.0) {
+                        oversleep = std::max(overran, 0.95 * oversleep);
+                        spinMargin = std::min(std::max(1.5 * oversleep, 0.0002), 0.004);
+                    }
+                    remaining = deadline - after;
+                }
+                while (now() < deadline) {
+                }
+            }
+            double start = now();
+            double interval = start - lastFrame;
+            lastFrame = start;
+            if (period > 0.0) {
+                lateSum += start - deadline;
+                deadline += period;
+                if (deadline < start) {
+                    // More than a frame behind. Skip the missed deadlines instead of
+                    // rendering a burst of frames to catch up.
+                    missed++;
+                    deadline = start + period;
+                }
+            }
+
+            frames++;
+            intervalSum += interval;
+            intervalSquaredSum += interval * interval;
+            if (period > 0.0) {
+                worstDeviation = std::max(worstDeviation, fabs(interval - period));
+            }
+            return interval;
+        }
+        double wait() {
+            return wait(sleepFor);
+        }
+
+        double getPeriod() const {
+            return period;
+        }
+        long getFrames() const {
+            return frames;
+        }
+        // Frames which started more than a period after their deadline.
+        long getMissed() const {
+            return missed;
+        }
+        double averageInterval() const {
+            return frames > 0 ? intervalSum / frames : 0.0;
+        }
+        // Standard deviation of the frame intervals, in seconds.
+        double jitter() const {
+            if (frames < 2) return 0.0;
+            double mean = intervalSum / frames;
+            return sqrt(std::max(0.0, intervalSquaredSum / frames - mean * mean));
+        }
+        // Largest difference between a frame interval and the period.
+        double worstJitter() const {
+            return worstDeviation;
+        }
+        // Average time a frame started after its deadline.
+        double averageLateness() const {
+            return frames > 0 && period > 0.0 ? lateSum / frames : 0.0;
+        }
+};
+#endif
@@ -0,0 +1,212 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <glad/glad.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "trace.hpp"
+
+/*
+ * Measures the GPU time of named passes with timestamp queries.
+ * begin() and end() put a timestamp into the command stream, so passes may
+ * nest, which GL_TIME_ELAPSED queries may not. The queries of a frame are read
+ * back when their ring slot comes round again, latency frames later, when they
+ * are normally long available, so measuring never stalls the pipeline. Frames
+ * whose results are still missing then are skipped.
+ * Every pass keeps its time per frame, summed over all its calls, for the last
+ * window frames it ran in. While tracing, every pass is also recorded on the
+ * GPU track of the trace, moved onto the CPU clock by comparing it with the
+ * GPU's clock every second.
+ */
+class GpuProfiler {
+    struct Zone {
+        int pass;
+        unsigned int begin, end;
+    };
+    struct Frame {
+        std::vector<Zone> zones; // query objects are kept for reuse
+        int used;
+    };
+    struct Pass {
+        const char* name; // the caller's, e.g. a string literal
+        std::vector<double> samples; // milliseconds per frame, a ring of window entries
+        size_t next;
+        long calls, frames;
+    };
+    std::vector<Pass> passes;
+    std::vector<Frame> frames;
+    int current;
+    std::vector<int> open; // zones begun but not ended, innermost last
+    size_t window;
+    long skipped;
+    int64_t gpuToCpu;      // nanoseconds from a GPU timestamp to CLOCK_MONOTONIC
+    int64_t lastCalibration;
+
+    int find(const char* name) {
+        for (size_t i = 0; i < passes.size(); i++) {
+            if (strcmp(passes[i].name, name) == 0) return i;
+        }
+        Pass p;
+        p.name = name;
+        p.next = 0;
+        p.calls = 0;
+        p.frames = 0;
+        passes.push_back(p);
+        return passes.size() - 1;
+    }
+
+    void collect(Frame& f) {
+        if (f.used == 0) return;
+        for (int i = 0; i < f.used; i++) {
+            int available = 0;
+            glGetQueryObjectiv(f.zones[i].end, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                skipped++;
+                f.used = 0;
+                return;
+            }
+        }
+        std::vector<double> total(passes.size(), 0.0);
+        std::vector<int> calls(passes.size(), 0);
+        for (int i = 0; i < f.used; i++) {
+            GLuint64 begin, end;
+            glGetQueryObjectui64v(f.zones[i].begin, GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(f.zones[i].end, GL_QUERY_RESULT, &end);
+            total[f.zones[i].pass] += 1.0e-6 * (double) (end - begin);
+            calls[f.zones[i].pass]++;
+            if (Trace::enabled()) {
+                Trace::recordGpu(passes[f.zones[i].pass].name, begin + gpuToCpu, end + gpuToCpu);
+            }
+        }
+        for (size_t p = 0; p < passes.size(); p++) {
+            if (calls[p] == 0) continue;
+            Pass& pass = passes[p];
+            if (pass.samples.size() < window) {
+                pass.samples.push_back(total[p]);
+            } else {
+                pass.samples[pass.next] = total[p];
+            }
+            pass.next = (pass.next + 1) % window;
+            pass.calls += calls[p];
+            pass.frames++;
+        }
+        f.used = 0;
+    }
+    public:
+        GpuProfiler(int latency = 3, int window = 600) {
+            frames.resize(std::max(latency, 1) + 1);
+            for (size_t i = 0; i < frames.size(); i++) {
+                frames[i].used = 0;
+            }
+            current = 0;
+            this->window = std::max(window, 1);
+            skipped = 0;
+            gpuToCpu = 0;
+            lastCalibration = 0;
+        }
+        ~GpuProfiler() {
+            for (size_t i = 0; i < frames.size(); i++) {
+                for (size_t z = 0; z < frames[i].zones.size(); z++) {
+                    glDeleteQueries(1, &frames[i].zones[z].begin);
+                    glDeleteQueries(1, &frames[i].zones[z].end);
+                }
+            }
+        }
+        GpuProfiler(const GpuProfiler&) = delete;
+        GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+        // Starts a new frame, reading back the oldest one in the ring.
+        void beginFrame() {
+            if (Trace::enabled() && Trace::now() - lastCalibration > 1000000000) {
+                // The GPU's clock now, not when the queued commands have run.
+                GLint64 gpu;
+                glGetInteger64v(GL_TIMESTAMP, &gpu);
+                lastCalibration = Trace::now();
+                gpuToCpu = lastCalibration - gpu;
+            }
+            current = (current + 1) % frames.size();
+            collect(frames[current]);
+        }
+
+        // name has to outlive the profiler, e.g. a string literal.
+        void begin(const char* name) {
+            Frame& f = frames[current];
+            if (f.used == (int) f.zones.size()) {
+                Zone z;
+                glGenQueries(1, &z.begin);
+                glGenQueries(1, &z.end);
+                f.zones.push_back(z);
+            }
+            Zone& z = f.zones[f.used];
+            z.pass = find(name);
+            glQueryCounter(z.begin, GL_TIMESTAMP);
+            open.push_back(f.used);
+            f.used++;
+        }
+        void end() {
+            glQueryCounter(frames[current].zones[open.back()].end, GL_TIMESTAMP);
+            open.pop_back();
+        }
+
+        // Reads back every frame still in flight, waiting for the GPU.
+        void flush() {
+            glFinish();
+            for (size_t i = 1; i <= frames.size(); i++) {
+                collect(frames[(current + i) % frames.size()]);
+            }
+        }
+
+        // Prints min, average and 99th percentile per pass over the window.
+        void report() {
+            printf("%-16s %8s %10s %10s %10s\n", "gpu pass", "calls", "min ms", "avg ms", "p99 ms");
+            for (size_t p = 0; p < passes.size(); p++) {
+                const Pass& pass = passes[p];
+                if (pass.samples.empty()) continue;
+                std::vector<double> s(pass.samples);
+                std::sort(s.begin(), s.end());
+                double sum = 0.0;
+                for (size_t i = 0; i < s.size(); i++) sum += s[i];
+                size_t p99 = std::min(s.size() - 1, (size_t) (0.99 * s.size()));
+                printf("%-16s %8.1f %10.3f %10.3f %10.3f\n", pass.name, (double) pass.calls / pass.frames,
+                        s[0], sum / s.size(), s[p99]);
+            }
+            if (skipped > 0) {
+                printf("%ld frames skipped, their queries were not ready in time\n", skipped);
+            }
+        }
+
+        // One line with the average time of every pass, e.g. for a window title.
+        std::string summary() {
+            std::string line;
+            for (size_t p = 0; p < passes.size(); p++) {
+                const Pass& pass = passes[p];
+                if (pass.samples.empty()) continue;
+                double sum = 0.0;
+                for (size_t i = 0; i < pass.samples.size(); i++) sum += pass.samples[i];
+                char part[96];
+                snprintf(part, sizeof(part), "%s%s %.2f ms", line.empty() ? "" : " | ", pass.name, sum / pass.samples.size());
+                line += part;
+            }
+            return line;
+        }
+};
+
+// Measures the enclosing scope as a pass, does nothing without a profiler.
+class GpuZone {
+    GpuProfiler* profiler;
+    public:
+        GpuZone(GpuProfiler* profiler, const char* name) {
+            this->profiler = profiler;
+            if (profiler != NULL) profiler->begin(name);
+        }
+        ~GpuZone() {
+            if (profiler != NULL) profiler->end();
+        }
+        GpuZone(const GpuZone&) = delete;
+        GpuZone& operator=(const GpuZone&) = delete;
+};
+#endif
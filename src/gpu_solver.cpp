@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "gpu_solver.hpp"
+
+// Layout of the std140 uniform block Solver in the solver kernels.
+struct SolverUniforms {
+    float delta;
+    float damping;
+};
+
+// Length of the per workgroup source list of compute_blocked.glsl.
+const int MAX_TILE_SOURCES = 256;
+
+unsigned int createHeightTexture(int width, int height, GLenum format, const float* data) {
+    unsigned int tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RED, GL_FLOAT, data);
+    return tex;
+}
+
+GpuSolver::GpuSolver(int width, int height, int padding, float csqrd, int tileWidth, int tileHeight, int timeBlock, bool halfPrecision)
+        : WaveSolver(width, height, padding) {
+    this->csqrd = csqrd;
+    this->tileWidth = tileWidth;
+    this->tileHeight = tileHeight;
+    this->timeBlock = timeBlock;
+    this->halfPrecision = halfPrecision;
+
+    stencilShader = createStencilShader(1);
+    blockedShader = NULL;
+    if (timeBlock > 1 && timeBlockFits(tileWidth, tileHeight, timeBlock)) {
+        blockedShader = createStencilShader(timeBlock);
+    }
+    injectShader = new ComputeShader("./src/shaders/compute/source_inject.glsl",
+            halfPrecision ? "#define HEIGHT_FORMAT r16f\n" : "");
+    injectShader->use();
+    injectShader->setFloat("csqrd", csqrd);
+    injectShader->setFloat("padding", padding);
+    injectShader->setFloat("ampResponseRate", SOURCE_AMP_RESPONSE_RATE);
+    injectShader->setVec2i("SIM_SIZE", width, height);
+
+    // Two heights per cell (latest and previous), plus two spares for the blocked kernel.
+    std::vector<float> zeros((size_t) stride * getRows(), 0.0f);
+    stateCount = blockedShader != NULL ? 4 : 2;
+    for (int i = 0; i < stateCount; i++) {
+        state[i] = createHeightTexture(stride, getRows(), heightFormat(), zeros.data());
+    }
+    glGenTextures(1, &sourceSum);
+    glBindTexture(GL_TEXTURE_2D, sourceSum);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, stride, getRows(), 0, GL_RED_INTEGER, GL_INT, zeros.data());
+
+    // The source buffers are created by the first step, which uploads the whole table.
+    sourceParams = 0;
+    sourceStates = 0;
+    sourceCapacity = 0;
+
+    glGenBuffers(1, &solverUniforms);
+    glBindBuffer(GL_UNIFORM_BUFFER, solverUniforms);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(SolverUniforms), NULL, GL_DYNAMIC_DRAW);
+    // Forces the first step to upload delta and damping.
+    uniformDelta = -1.0;
+    uniformDamping = -1.0;
+    profiler = NULL;
+}
+
+GpuSolver::~GpuSolver() {
+    glDeleteTextures(stateCount, state);
+    glDeleteTextures(1, &sourceSum);
+    glDeleteBuffers(1, &sourceParams);
+    glDeleteBuffers(1, &sourceStates);
+    glDeleteBuffers(1, &solverUniforms);
+    delete stencilShader;
+    delete blockedShader;
+    delete injectShader;
+}
+
+bool GpuSolver::timeBlockFits(int tileWidth, int tileHeight, int timeBlock) {
+    // compute_blocked.glsl keeps two time levels of the tile plus halo in shared memory,
+    // next to the list of the sources inside it and its length.
+    int maxShared;
+    glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &maxShared);
+    int required = 2 * (tileWidth + 2 * timeBlock) * (tileHeight + 2 * timeBlock) * sizeof(float)
+            + (MAX_TILE_SOURCES + 1) * sizeof(int);
+    if (required > maxShared) {
+        printf("Time block %d with tile %dx%d needs %d bytes of shared memory, only %d available\n",
+                timeBlock, tileWidth, tileHeight, required, maxShared);
+        return false;
+    }
+    return true;
+}
+
+GLenum GpuSolver::heightFormat() const {
+    return halfPrecision ? GL_R16F : GL_R32F;
+}
+
+ComputeShader* GpuSolver::createStencilShader(int timeBlock) {
+    // Compiles the solver kernel for the workgroup shape and sets up the uniforms
+    // which stay constant during the simulation.
+    std::string defines = "#define TILE_X " + std::to_string(tileWidth) + "\n#define TILE_Y " + std::to_string(tileHeight) + "\n";
+    if (halfPrecision) {
+        defines += "#define HEIGHT_FORMAT r16f\n";
+    }
+    ComputeShader* cs = (timeBlock > 1)
+        ? new ComputeShader("./src/shaders/compute/compute_blocked.glsl", defines + "#define TIME_BLOCK " + std::to_string(timeBlock)
+                + "\n#define MAX_TILE_SOURCES " + std::to_string(MAX_TILE_SOURCES) + "\n")
+        : (tileWidth == 1 && tileHeight == 1)
+        ? new ComputeShader("./src/shaders/compute/compute.glsl", defines)
+        : new ComputeShader("./src/shaders/compute/compute_tiled.glsl", defines);
+    cs->use();
+    cs->setFloat("csqrd", csqrd);
+    cs->setFloat("padding", padding);
+    // compute.glsl runs one workgroup per cell and needs no bounds.
+    if (timeBlock > 1 || tileWidth != 1 || tileHeight != 1) {
+        cs->setVec2i("SIM_SIZE", width, height);
+    }
+    return cs;
+}
+
+void GpuSolver::createSourceBuffers(int capacity) {
+    glGenBuffers(1, &sourceParams);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sourceParams);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(SourceParams), NULL, GL_DYNAMIC_DRAW);
+
+    // A zeroed state restarts every source on its first step, as the epochs differ.
+    glGenBuffers(1, &sourceStates);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sourceStates);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(SourceState), NULL, GL_DYNAMIC_COPY);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    sourceCapacity = capacity;
+}
+
+void GpuSolver::syncSources(SourceTable& sources) {
+    // Uploads the source parameters changed since the last call. When the table
+    // outgrew the buffers they are reallocated, keeping the state on the GPU.
+    int count = sources.size();
+    if (count > sourceCapacity) {
+        unsigned int oldParams = sourceParams, oldStates = sourceStates;
+        int oldCapacity = sourceCapacity;
+        createSourceBuffers(std::max(count, 2 * oldCapacity));
+        if (oldCapacity > 0) {
+            glBindBuffer(GL_COPY_READ_BUFFER, oldStates);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_SHADER_STORAGE_BUFFER, 0, 0, oldCapacity * sizeof(SourceState));
+        }
+        glDeleteBuffers(1, &oldParams);
+        glDeleteBuffers(1, &oldStates);
+        sources.markAllDirty();
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sourceParams);
+    sources.flush([](int first, int n, const SourceParams* data) {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(SourceParams), n * sizeof(SourceParams), data);
+    });
+}
+
+void GpuSolver::advanceSources(int count, int steps, bool inject) {
+    // Advances the phase and amplitude of every source by the given number of
+    // steps and optionally injects them into the latest heights.
+    if (count == 0) {
+        return;
+    }
+    GpuZone zone(profiler, "inject");
+    injectShader->use();
+    injectShader->setInt("sourceCount", count);
+    injectShader->setInt("steps", steps);
+    injectShader->setBool("inject", inject);
+    injectShader->setBool("fold", false);
+    glDispatchCompute((count + 63) / 64, 1, 1);
+    if (inject) {
+        // Sources sharing a cell were summed in sourceSum, which the second pass adds to the heights.
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        injectShader->setBool("fold", true);
+        glDispatchCompute((count + 63) / 64, 1, 1);
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+void GpuSolver::bindState() {
+    // Image units 0 and 1 hold the latest and previous heights, units 2 and 3 the spares,
+    // unit 4 the source sums.
+    for (int i = 0; i < stateCount; i++) {
+        glBindImageTexture(i, state[i], 0, GL_FALSE, 0, GL_READ_WRITE, heightFormat());
+    }
+    glBindImageTexture(4, sourceSum, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32I);
+}
+
+void GpuSolver::step(int steps, float delta, float damping, SourceTable& sources) {
+    // Whole blocks of timeBlock steps are taken by the temporally blocked kernel,
+    // the rest one step per dispatch.
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, solverUniforms);
+    if (delta != uniformDelta || damping != uniformDamping) {
+        SolverUniforms u = { delta, damping };
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SolverUniforms), &u);
+        uniformDelta = delta;
+        uniformDamping = damping;
+    }
+    {
+        GpuZone zone(profiler, "sources");
+        syncSources(sources);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sourceParams);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, sourceStates);
+    bindState();
+
+    int count = sources.size();
+    while (steps > 0) {
+        bool blocked = blockedShader != NULL && steps >= timeBlock;
+        int n = blocked ? timeBlock : 1;
+
+        // The blocked kernel receives the source state of its first step.
+        if (blocked) {
+            advanceSources(count, 1, false);
+            blockedShader->use();
+            blockedShader->setInt("sourceCount", count);
+        } else {
+            stencilShader->use();
+        }
+
+        // One invocation per simulation cell, rounded up to whole tiles.
+        {
+            GpuZone zone(profiler, blocked ? "blocked" : "stencil");
+            glDispatchCompute((width + tileWidth - 1) / tileWidth, (height + tileHeight - 1) / tileHeight, 1);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        }
+        if (blocked) {
+            // The blocked kernel writes the latest and previous heights into the spares.
+            std::swap(state[0], state[2]);
+            std::swap(state[1], state[3]);
+        } else {
+            // The single step kernels write the new heights over the previous heights,
+            // so after a step the roles of the two textures are swapped.
+            std::swap(state[0], state[1]);
+        }
+        bindState();
+
+        // The blocked kernel injects the sources itself, after the single step
+        // kernels they are scattered into the new heights by a separate pass.
+        if (blocked) {
+            if (n > 1) advanceSources(count, n - 1, false);
+        } else {
+            advanceSources(count, 1, true);
+        }
+        steps -= n;
+    }
+}
+
+void GpuSolver::reset() {
+    for (int i = 0; i < stateCount; i++) {
+        glClearTexImage(state[i], 0, GL_RED, GL_FLOAT, NULL);
+    }
+    glClearTexImage(sourceSum, 0, GL_RED_INTEGER, GL_INT, NULL);
+    if (sourceCapacity > 0) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, sourceStates);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    }
+}
+
+void GpuSolver::readHeights(bool latest, std::vector<float>& out) {
+    out.resize((size_t) stride * getRows());
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glBindTexture(GL_TEXTURE_2D, heightTexture(latest));
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, out.data());
+}
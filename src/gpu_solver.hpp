@@ -0,0 +1,78 @@
+#include <glad/glad.h>
+
+#include "gpu_profiler.hpp"
+#include "shader.hpp"
+#include "wave_solver.hpp"
+
+#ifndef GPU_SOLVER_H
+#define GPU_SOLVER_H
+
+// Creates a linearly filtered, edge clamped single channel texture for heights.
+unsigned int createHeightTexture(int width, int height, GLenum format, const float* data);
+
+/*
+ * Compute shader solver. The heights live in textures bound to image units
+ * 0 to 3, the source table in the storage buffers at bindings 0 and 1 and
+ * delta and damping in the uniform block Solver at binding 1. All of them are
+ * bound again by every step(), so several solvers may share a context.
+ * Only changed source parameters are uploaded, so a source table should only
+ * feed one GpuSolver at a time.
+ * Every step runs the stencil kernel (compute.glsl or compute_tiled.glsl)
+ * followed by source_inject.glsl. With a time block above one, whole blocks
+ * of steps run in a single dispatch of compute_blocked.glsl instead.
+ */
+class GpuSolver : public WaveSolver {
+    float csqrd;
+    int tileWidth, tileHeight;
+    int timeBlock;
+    bool halfPrecision;
+    ComputeShader* stencilShader;
+    ComputeShader* blockedShader; // NULL when temporal blocking is disabled.
+    ComputeShader* injectShader;
+    // Latest, previous and two spares which receive the output of the blocked kernel.
+    unsigned int state[4];
+    int stateCount;
+    // Fixed point sums of the sources sharing a cell, zero outside of advanceSources (image unit 4).
+    unsigned int sourceSum;
+    // SourceParams uploaded from the table (binding 0) and SourceState advanced on the GPU (binding 1).
+    unsigned int sourceParams;
+    unsigned int sourceStates;
+    int sourceCapacity;
+    unsigned int solverUniforms;
+    float uniformDelta, uniformDamping;
+    GpuProfiler* profiler; // NULL when not profiling
+
+    GLenum heightFormat() const;
+    ComputeShader* createStencilShader(int timeBlock);
+    void createSourceBuffers(int capacity);
+    void syncSources(SourceTable& sources);
+    void advanceSources(int count, int steps, bool inject);
+    void bindState();
+    public:
+        GpuSolver(int width, int height, int padding, float csqrd, int tileWidth, int tileHeight, int timeBlock = 1, bool halfPrecision = false);
+        ~GpuSolver();
+        GpuSolver(const GpuSolver&) = delete;
+        GpuSolver& operator=(const GpuSolver&) = delete;
+
+        // Whether the shared memory of the blocked kernel fits for the given tile and time block.
+        static bool timeBlockFits(int tileWidth, int tileHeight, int timeBlock);
+
+        const char* name() const {
+            return "gpu";
+        }
+        void step(int steps, float delta, float damping, SourceTable& sources);
+        void reset();
+        void readHeights(bool latest, std::vector<float>& out);
+        unsigned int heightTexture(bool latest) const {
+            return state[latest ? 0 : 1];
+        }
+
+        int getTimeBlock() const {
+            return blockedShader != NULL ? timeBlock : 1;
+        }
+        // Measures the source upload, stencil, blocked and inject passes with the profiler.
+        void setProfiler(GpuProfiler* profiler) {
+            this->profiler = profiler;
+        }
+};
+#endif
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#include <stb/stb_image_write.h>
+
+#include "image_encoder.hpp"
+#include "trace.hpp"
+
+// Encodes RGB pixels as QOI, see https://qoiformat.org/qoi-specification.pdf
+static void encodeQoi(const unsigned char* rgb, int width, int height, std::vector<unsigned char>& out) {
+    size_t pixels = (size_t) width * height;
+    out.clear();
+    out.reserve(14 + pixels * 4 + 8);
+    const unsigned char magic[4] = { 'q', 'o', 'i', 'f' };
+    out.insert(out.end(), magic, magic + 4);
+    for (int v : { width, height }) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out.push_back((v >> shift) & 0xff);
+        }
+    }
+    out.push_back(3); // channels
+    out.push_back(0); // sRGB
+
+    unsigned char index[64][3];
+    memset(index, 0, sizeof(index));
+    // The previous pixel starts out as opaque black, alpha hashes as 255 * 11.
+    unsigned char prev[3] = { 0, 0, 0 };
+    int run = 0;
+    for (size_t i = 0; i < pixels; i++) {
+        const unsigned char* px = rgb + 3 * i;
+        if (px[0] == prev[0] && px[1] == prev[1] && px[2] == prev[2]) {
+            run++;
+            if (run == 62 || i == pixels - 1) {
+                out.push_back(0xc0 | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out.push_back(0xc0 | (run - 1));
+            run = 0;
+        }
+        int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+        if (memcmp(index[hash], px, 3) == 0) {
+            out.push_back(hash);
+        } else {
+            memcpy(index[hash], px, 3);
+            signed char dr = (signed char) (px[0] - prev[0]);
+            signed char dg = (signed char) (px[1] - prev[1]);
+            signed char db = (signed char) (px[2] - prev[2]);
+            int drg = dr - dg, dbg = db - dg;
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+            } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                out.push_back(0x80 | (dg + 32));
+                out.push_back((drg + 8) << 4 | (dbg + 8));
+            } else {
+                out.push_back(0xfe);
+                out.insert(out.end(), px, px + 3);
+            }
+        }
+        memcpy(prev, px, 3);
+    }
+    const unsigned char end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    out.insert(out.end(), end, end + 8);
+}
+
+ImageEncoder::ImageEncoder(ImageFormat format, int workerCount, int queueDepth) {
+    this->format = format;
+    stopping = false;
+    encoded = 0;
+    failed = 0;
+    dropped = 0;
+    stalls = 0;
+    encodeSeconds = 0.0;
+    workerCount = std::max(workerCount, 1);
+    // A worker without a slot to encode would idle.
+    slots.resize(std::max(queueDepth, workerCount));
+    for (size_t i = 0; i < slots.size(); i++) {
+        freeSlots.push_back(i);
+    }
+    for (int i = 0; i < workerCount; i++) {
+        workers.push_back(std::thread(&ImageEncoder::work, this));
+    }
+}
+
+ImageEncoder::~ImageEncoder() {
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queued.notify_all();
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+bool ImageEncoder::encode(const Slot& slot) {
+    if (format == IMAGE_PNG) {
+        return stbi_write_png(slot.path.c_str(), slot.width, slot.height, 3, slot.rgb.data(), slot.width * 3) != 0;
+    }
+    std::vector<unsigned char> qoi;
+    encodeQoi(slot.rgb.data(), slot.width, slot.height, qoi);
+    FILE* file = fopen(slot.path.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+    bool ok = fwrite(qoi.data(), 1, qoi.size(), file) == qoi.size();
+    return fclose(file) == 0 && ok;
+}
+
+void ImageEncoder::work() {
+    Trace::setThreadName("image encoder");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        queued.wait(lock, [this] { return !queue.empty() || stopping; });
+        if (queue.empty()) {
+            return;
+        }
+        int slot = queue.front();
+        queue.pop_front();
+        lock.unlock();
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bool ok;
+        {
+            TRACE_ZONE("encode");
+            ok = encode(slots[slot]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (!ok) {
+            printf("Could not write %s\n", slots[slot].path.c_str());
+        }
+
+        lock.lock();
+        encodeSeconds += (end.tv_sec - start.tv_sec) + 1.0e-9 * (end.tv_nsec - start.tv_nsec);
+        if (ok) {
+            encoded++;
+        } else {
+            failed++;
+        }
+        freeSlots.push_back(slot);
+        freed.notify_all();
+    }
+}
+
+bool ImageEncoder::submit(const std::string& path, int width, int height, const unsigned char* rgb, bool bottomFirst, bool wait) {
+    int slot;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (freeSlots.empty()) {
+            if (!wait) {
+                dropped++;
+                return false;
+            }
+            stalls++;
+            freed.wait(lock, [this] { return !freeSlots.empty(); });
+        }
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    // The slot belongs to this thread until it is queued. Its buffer keeps
+    // its capacity, so it is only allocated for the first images.
+    Slot& s = slots[slot];
+    s.path = path;
+    s.width = width;
+    s.height = height;
+    size_t row = (size_t) width * 3;
+    s.rgb.resize(row * height);
+    for (int y = 0; y < height; y++) {
+        memcpy(s.rgb.data() + y * row, rgb + (bottomFirst ? height - 1 - y : y) * row, row);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(slot);
+    queued.notify_one();
+    return true;
+}
+
+void ImageEncoder::finish() {
+    std::unique_lock<std::mutex> lock(mutex);
+    freed.wait(lock, [this] { return freeSlots.size() == slots.size(); });
+}
@@ -0,0 +1,87 @@
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef IMAGE_ENCODER_H
+#define IMAGE_ENCODER_H
+
+// Lossless formats an ImageEncoder writes.
+enum ImageFormat {
+    IMAGE_PNG, // stbi_write_png, small files but slow to encode
+    IMAGE_QOI  // "Quite OK Image" format, several times faster than PNG at a similar size
+};
+
+/*
+ * Encodes RGB images into files on a fixed set of worker threads.
+ * submit() copies the image into one of queueDepth slots and returns, the
+ * workers encode and write the slots in parallel, so a frame rate can be kept
+ * that a single encoder could not reach. When every slot is taken submit()
+ * either waits for a worker or drops the image, so memory stays bounded.
+ */
+class ImageEncoder {
+    struct Slot {
+        std::vector<unsigned char> rgb; // top row first
+        std::string path;
+        int width, height;
+    };
+    ImageFormat format;
+    std::vector<Slot> slots;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable freed;
+    std::deque<int> queue; // slots waiting for a worker, oldest first
+    std::vector<int> freeSlots;
+    bool stopping;
+
+    long encoded, failed, dropped, stalls;
+    double encodeSeconds; // summed over all workers
+
+    void work();
+    bool encode(const Slot& slot);
+    public:
+        ImageEncoder(ImageFormat format, int workerCount, int queueDepth);
+        ~ImageEncoder();
+        ImageEncoder(const ImageEncoder&) = delete;
+        ImageEncoder& operator=(const ImageEncoder&) = delete;
+
+        static const char* extension(ImageFormat format) {
+            return format == IMAGE_PNG ? "png" : "qoi";
+        }
+        // Queues tightly packed RGB rows to be written to path. Rows are flipped
+        // if they are bottom row first, as glReadPixels returns them. Without wait
+        // the image is dropped and false returned when no slot is free.
+        bool submit(const std::string& path, int width, int height, const unsigned char* rgb, bool bottomFirst, bool wait);
+        // Waits until every queued image was written.
+        void finish();
+
+        ImageFormat getFormat() const {
+            return format;
+        }
+        int getWorkers() const {
+            return (int) workers.size();
+        }
+        long getEncoded() const {
+            return encoded;
+        }
+        long getFailed() const {
+            return failed;
+        }
+        // Images which were dropped, and which had to wait for a free slot.
+        long getDropped() const {
+            return dropped;
+        }
+        long getStalls() const {
+            return stalls;
+        }
+        // Average time a worker spent encoding and writing an image, in seconds.
+        double averageEncodeTime() const {
+            return encoded > 0 ? encodeSeconds / encoded : 0.0;
+        }
+};
+#endif
@@ -22,54 +22,162 @@
 #include "shader.hpp"
 #include "util.hpp"
 #include "source.hpp"
-
-#define MAX_SOURCES 10 // changing this requires a change in the shader.
+#include "sim_clock.hpp"
+#include "cpu_solver.hpp"
+#include "gpu_solver.hpp"
+#include "egl_context.hpp"
+#include "render_target.hpp"
+#include "frame_capture.hpp"
+#include "video_stream.hpp"
+#include "still_capture.hpp"
+#include "frame_pacer.hpp"
+#include "gpu_profiler.hpp"
+#include "trace.hpp"
+
+#define MAX_SOURCES 64 // Size of the pool of sources placed by the user and the animation.
 
 // Settings
 int WINDOW_WIDTH = 720;
 int WINDOW_HEIGHT = 720;
-const int SIMULATION_WIDTH = 256;
-const int SIMULATION_HEIGHT = 256;
-const int PADDING = 2;
+// Simulated cells (--grid WxH), surrounded by PADDING cells which stay zero
+// (--padding). The surface is drawn as a mesh of MESH_N x MESH_N vertices (--mesh),
+// 0 gives every cell its own vertex, up to MESH_MAX_N. The keys [ and ] halve and
+// double the grid at runtime, see resizeSimulation().
+int SIMULATION_WIDTH = 256;
+int SIMULATION_HEIGHT = 256;
+int PADDING = 2;
+int MESH_N = 0;
+#define MESH_MAX_N 1024
+#define MIN_GRID_SIZE 16
 const int FPS = 60;
-const bool RECORD_VIDEO = false;
+// Frames per second the window is rendered at, set with --fps. Independent of FPS,
+// the simulation follows the wall clock. 0 renders as fast as possible.
+// With VSYNC (--vsync) the swap waits for the display instead.
+double DISPLAY_FPS = FPS;
+bool VSYNC = false;
+// Time every GPU pass with timestamp queries and report it, set with --gpu-profile.
+bool GPU_PROFILE = false;
+// Write a Chrome trace of the last TRACE_EVENTS zones per thread and of the GPU
+// passes to TRACE_FILE at exit, set with --trace FILE and --trace-events N.
+const char* TRACE_FILE = NULL;
+long TRACE_EVENTS = 1 << 16;
+// Record the window into videorecording.y4m (or .ppm), set with --record.
+bool RECORD_VIDEO = false;
+// Container of recorded and offline frames, set with --video-format y4m|ppm|png|qoi.
+VideoFormat VIDEO_FORMAT = VIDEO_Y4M;
+// Threads encoding png/qoi image sequences (--encode-workers, 0 uses every core)
+// and images which may wait for them (--encode-queue, 0 for two per thread).
+int ENCODE_WORKERS = 0;
+int ENCODE_QUEUE = 0;
+// Screenshots are rendered offscreen at STILL_WIDTH x STILL_HEIGHT (--still-size, 0 for
+// the window size) with SUPERSAMPLE x SUPERSAMPLE samples per pixel (--supersample).
+// With neither set the window is read back instead.
+int STILL_WIDTH = 0;
+int STILL_HEIGHT = 0;
+int SUPERSAMPLE = 1;
+// Pixel buffers in flight when capturing frames.
+const int CAPTURE_SLOTS = 3;
+// Frames rendered without a window by the offline mode, set with --offline N.
+// 0 opens a window. The frames are rendered at WINDOW_WIDTH x WINDOW_HEIGHT,
+// set with --size, and written to OFFLINE_OUTPUT in VIDEO_FORMAT if set (--output).
+long OFFLINE_FRAMES = 0;
+const char* OFFLINE_OUTPUT = NULL;
+
+// Solver kernel workgroup shape, selectable with --tile WxH.
+// 1x1 selects the untiled kernel (compute.glsl), anything else the
+// shared memory kernel (compute_tiled.glsl).
+int TILE_WIDTH = 16;
+int TILE_HEIGHT = 16;
+bool BENCH_TILES = false;
+// Store heights as R16F instead of R32F (--fp16). Arithmetic stays 32 bit.
+bool HALF_PRECISION = false;
+bool COMPARE_PRECISION = false;
+// Number of solver steps taken per rendered frame, set with --steps N.
+int STEPS_PER_FRAME = 1;
+// Number of steps advanced inside a single dispatch by the temporally blocked
+// kernel (compute_blocked.glsl), set with --time-block K. 1 disables blocking.
+int TIME_BLOCK = 1;
+
+// Backend which runs the simulation, set with --solver. The CPU solver results
+// are streamed into textures for rendering.
+bool USE_CPU_SOLVER = false;
+// Instruction set of the CPU solver, set with --cpu-isa. CPU_ISA_COUNT picks the widest supported.
+CpuIsa CPU_ISA = CPU_ISA_COUNT;
+// Threads of the CPU solver, set with --cpu-threads. 0 uses every core.
+int CPU_THREADS = 0;
+// Steps fused per pass over memory by the CPU solver, set with --cpu-time-block. 1 disables blocking.
+int CPU_TIME_BLOCK = 1;
+bool CPU_BENCH = false;
+bool CPU_SCALING = false;
+bool CPU_BLOCKING = false;
+bool VERIFY_CPU = false;
 
 // Simulation Parameters
 const float SPEED = 0.1;
 const float FREQ = 1.5;
 const float AMPLITUDE = 2;
 float DAMPING = 0.02;
+const float CSQRD = 1.0;
+// Simulated time per solver step, set with --dt. Independent of the render rate.
+float SIM_DT = 1.0 / 60.0;
+// Steps which may be taken in a single frame to catch up, in multiples of STEPS_PER_FRAME.
+const int MAX_CATCHUP_FRAMES = 4;
+// Number of rain drops, set with --rain N. Every drop is a short lived source.
+int RAIN_DROPS = 0;
+const int RAIN_DROP_FRAMES = 90; // Lifetime of a drop in animation frames.
+const float RAIN_FREQ = 6.0;
+const float RAIN_AMPLITUDE = 1.0;
 
 Shader* waveShader;
 Shader* lightShader;
-ComputeShader* computeShader;
-ComputeShader* copyShader;
+// Projection of the wave shader for the window, stills use their own.
+glm::mat4 windowProjection;
+WaveSolver* solver;
 
 // ImGui
 bool show_demo_window = true;
 
 
 
+// Uniforms which change once per frame, shared by all programs through a
+// uniform buffer. Layout matches the std140 block Frame in the shaders.
+struct FrameUniforms {
+    glm::mat4 view;
+    float lightPos[4];
+    float time;
+    float alpha;
+    float unused[2]; // pads to the std140 size of the block
+};
+
 // OpenGL objects neccesary for rendering.
 struct GlObjects {
-    unsigned int tex_w;
-    unsigned int tex_h;
-    unsigned int* textures;
+    // Latest and previous heights of a solver without textures of its own,
+    // uploaded through the pixel buffer heightUpload. streamedSteps is the step
+    // of the simulation they show.
+    unsigned int streamed[2];
+    unsigned int heightUpload;
+    long streamedSteps;
+    unsigned int frameUniforms; // Uniform buffer of FrameUniforms, bound to binding 0.
     unsigned int VAO;
+    unsigned int meshVertices, meshIndices; // buffers of VAO
     unsigned int LightVAO;
     unsigned int PLANE_N; // Number of plane segments.
 } glObjects;
 
-struct VideoRecording {
-    unsigned char* memPtr;
-    unsigned long memSize; // in bytes
-    unsigned long offset;
-} VideoRecording;
+// Streams the frames recorded with --record to videorecording.y4m, .ppm or a directory of images.
+VideoStream* videoRecording = NULL;
+// Writes screenshots in the background, created with the first one.
+ImageEncoder* screenshotEncoder = NULL;
+GpuProfiler* gpuProfiler = NULL;
+
+// All sources, including the pool below and the rain drops.
+SourceTable sourceTable;
 
 // Information that should be send to the shader.
 struct SimulationData {
     Source* sources[MAX_SOURCES];
     int src_counter;
+    int rainStart; // Index of the first rain drop in the source table.
     float camPos[3];
     float perspectives[2][3] = {
         {0.0, 5.0, 8.8},
@@ -77,6 +185,7 @@ struct SimulationData {
     };
     size_t cur_perspective_idx = 1;
     float lightPos[3];
+    long steps; // Solver steps taken so far.
 } simData;
 
 // Struct to keep track of previous input state.
@@ -84,18 +193,243 @@ struct InputState {
     bool prev_right_mouse;
     bool prev_left_mouse;
     int prev_space;
+    int prev_grow, prev_shrink;
 } inputState;
 
-void render(double time);
+void render();
+bool resizeSimulation(int width, int height, int padding);
+
+void printUsage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --tile WxH      workgroup tile shape of the solver kernel (default %dx%d, 1x1 = untiled)\n", TILE_WIDTH, TILE_HEIGHT);
+    printf("  --bench-tiles   time the solver kernel for several tile shapes and exit\n");
+    printf("  --steps N       solver steps per rendered frame (default %d)\n", STEPS_PER_FRAME);
+    printf("  --time-block K  advance K steps per dispatch with the temporally blocked kernel (default %d = off)\n", TIME_BLOCK);
+    printf("  --dt T          simulated time per solver step (default %f)\n", SIM_DT);
+    printf("  --size WxH      window size, or resolution of the offline frames (default %dx%d)\n", WINDOW_WIDTH, WINDOW_HEIGHT);
+    printf("  --grid WxH      simulated cells (default %dx%d), [ and ] halve and double them at runtime\n", SIMULATION_WIDTH, SIMULATION_HEIGHT);
+    printf("  --padding N     cells of zero height around the grid (default %d)\n", PADDING);
+    printf("  --mesh N        vertices per side of the surface mesh, 0 for one per cell up to %d (default %d)\n", MESH_MAX_N, MESH_N);
+    printf("  --fps N         frames per second rendered in the window, 0 for unlimited (default %d)\n", FPS);
+    printf("  --vsync         let the display's refresh pace the window instead of --fps\n");
+    printf("  --gpu-profile   time every GPU pass, shown in the window title and reported at exit\n");
+    printf("  --trace FILE    write a Chrome trace of the CPU threads and GPU passes to FILE at exit\n");
+    printf("  --trace-events N  events kept per thread for --trace, the latest ones win (default %ld)\n", TRACE_EVENTS);
+    printf("  --offline N     render N frames without a window as fast as possible and exit\n");
+    printf("  --output FILE   write the offline frames to FILE\n");
+    printf("  --record        record the window into videorecording.y4m, .ppm or videorecording/\n");
+    printf("  --video-format y4m|ppm|png|qoi  container of --output and --record, png and qoi write image sequences (default y4m)\n");
+    printf("  --encode-workers N  threads encoding image sequences (default 0 = all cores)\n");
+    printf("  --encode-queue N    images which may wait for the encoder threads (default 0 = two per thread)\n");
+    printf("  --still-size WxH  render screenshots offscreen at this size instead of reading the window\n");
+    printf("  --supersample N   render screenshots with NxN samples per pixel (default 1)\n");
+    printf("  --rain N        let N rain drops fall on the surface (default %d)\n", RAIN_DROPS);
+    printf("  --fp16          store the height field in half precision\n");
+    printf("  --compare-precision  compare energy and drift of fp16 against fp32 storage and exit\n");
+    printf("  --solver gpu|cpu  backend which runs the simulation (default gpu)\n");
+    printf("  --cpu-bench     time the CPU solver kernels without a window and exit\n");
+    printf("  --cpu-scaling   report the CPU solver throughput against the thread count and exit\n");
+    printf("  --cpu-threads N threads of the CPU solver (default all cores)\n");
+    printf("  --cpu-time-block D  fuse D steps per pass over memory in the CPU solver (default %d = off)\n", CPU_TIME_BLOCK);
+    printf("  --cpu-blocking  report the CPU solver throughput against the time block depth and exit\n");
+    printf("  --cpu-isa ISA   instruction set of the CPU solver: scalar, sse4.1, avx2 or avx512 (default widest supported)\n");
+    printf("  --verify-cpu    compare the CPU solver against the GPU solver and exit\n");
+    printf("  --no-shader-cache  always compile shaders instead of loading cached program binaries\n");
+    printf("  --help          show this message\n");
+}
+
+bool parseArguments(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--tile") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &TILE_WIDTH, &TILE_HEIGHT) != 2 || TILE_WIDTH < 1 || TILE_HEIGHT < 1) {
+                printf("Invalid tile shape: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--bench-tiles") == 0) {
+            BENCH_TILES = true;
+        } else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+            STEPS_PER_FRAME = atoi(argv[++i]);
+            if (STEPS_PER_FRAME < 1) {
+                printf("Invalid number of steps per frame: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--time-block") == 0 && i + 1 < argc) {
+            TIME_BLOCK = atoi(argv[++i]);
+            if (TIME_BLOCK < 1) {
+                printf("Invalid time block: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &WINDOW_WIDTH, &WINDOW_HEIGHT) != 2 || WINDOW_WIDTH < 1 || WINDOW_HEIGHT < 1) {
+                printf("Invalid size: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &SIMULATION_WIDTH, &SIMULATION_HEIGHT) != 2
+                    || SIMULATION_WIDTH < MIN_GRID_SIZE || SIMULATION_HEIGHT < MIN_GRID_SIZE) {
+                printf("Invalid grid size: %s, at least %dx%d\n", argv[i], MIN_GRID_SIZE, MIN_GRID_SIZE);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--padding") == 0 && i + 1 < argc) {
+            PADDING = atoi(argv[++i]);
+            if (PADDING < 1 || PADDING > 64) {
+                printf("Invalid padding: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--mesh") == 0 && i + 1 < argc) {
+            MESH_N = atoi(argv[++i]);
+            if (MESH_N != 0 && (MESH_N < 2 || MESH_N > 4096)) {
+                printf("Invalid mesh resolution: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            DISPLAY_FPS = atof(argv[++i]);
+            if (DISPLAY_FPS < 0.0) {
+                printf("Invalid frame rate: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--vsync") == 0) {
+            VSYNC = true;
+        } else if (strcmp(argv[i], "--gpu-profile") == 0) {
+            GPU_PROFILE = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            TRACE_FILE = argv[++i];
+        } else if (strcmp(argv[i], "--trace-events") == 0 && i + 1 < argc) {
+            TRACE_EVENTS = atol(argv[++i]);
+            if (TRACE_EVENTS < 1) {
+                printf("Invalid number of trace events: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--offline") == 0 && i + 1 < argc) {
+            OFFLINE_FRAMES = atol(argv[++i]);
+            if (OFFLINE_FRAMES < 1) {
+                printf("Invalid number of frames: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            OFFLINE_OUTPUT = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0) {
+            RECORD_VIDEO = true;
+        } else if (strcmp(argv[i], "--video-format") == 0 && i + 1 < argc) {
+            i++;
+            const char* formats[] = { "y4m", "ppm", "png", "qoi" };
+            int format = 0;
+            while (format < 4 && strcmp(argv[i], formats[format]) != 0) {
+                format++;
+            }
+            if (format == 4) {
+                printf("Unknown video format: %s\n", argv[i]);
+                return false;
+            }
+            VIDEO_FORMAT = (VideoFormat) format;
+        } else if (strcmp(argv[i], "--still-size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &STILL_WIDTH, &STILL_HEIGHT) != 2 || STILL_WIDTH < 1 || STILL_HEIGHT < 1) {
+                printf("Invalid still size: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--supersample") == 0 && i + 1 < argc) {
+            SUPERSAMPLE = atoi(argv[++i]);
+            if (SUPERSAMPLE < 1 || SUPERSAMPLE > 16) {
+                printf("Invalid supersampling factor: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--encode-workers") == 0 && i + 1 < argc) {
+            ENCODE_WORKERS = atoi(argv[++i]);
+            if (ENCODE_WORKERS < 0) {
+                printf("Invalid number of encoder threads: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--encode-queue") == 0 && i + 1 < argc) {
+            ENCODE_QUEUE = atoi(argv[++i]);
+            if (ENCODE_QUEUE < 0) {
+                printf("Invalid encoder queue depth: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--rain") == 0 && i + 1 < argc) {
+            RAIN_DROPS = atoi(argv[++i]);
+            if (RAIN_DROPS < 0) {
+                printf("Invalid number of rain drops: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--fp16") == 0) {
+            HALF_PRECISION = true;
+        } else if (strcmp(argv[i], "--compare-precision") == 0) {
+            COMPARE_PRECISION = true;
+        } else if (strcmp(argv[i], "--solver") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "gpu") != 0 && strcmp(argv[i], "cpu") != 0) {
+                printf("Unknown solver: %s\n", argv[i]);
+                return false;
+            }
+            USE_CPU_SOLVER = strcmp(argv[i], "cpu") == 0;
+        } else if (strcmp(argv[i], "--cpu-bench") == 0) {
+            CPU_BENCH = true;
+        } else if (strcmp(argv[i], "--cpu-scaling") == 0) {
+            CPU_SCALING = true;
+        } else if (strcmp(argv[i], "--cpu-threads") == 0 && i + 1 < argc) {
+            CPU_THREADS = atoi(argv[++i]);
+            if (CPU_THREADS < 1) {
+                printf("Invalid number of threads: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--cpu-time-block") == 0 && i + 1 < argc) {
+            CPU_TIME_BLOCK = atoi(argv[++i]);
+            if (CPU_TIME_BLOCK < 1) {
+                printf("Invalid time block: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--cpu-blocking") == 0) {
+            CPU_BLOCKING = true;
+        } else if (strcmp(argv[i], "--verify-cpu") == 0) {
+            VERIFY_CPU = true;
+        } else if (strcmp(argv[i], "--cpu-isa") == 0 && i + 1 < argc) {
+            if (!parseCpuIsa(argv[++i], &CPU_ISA)) {
+                printf("Unknown instruction set: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--no-shader-cache") == 0) {
+            ShaderProgram::cacheDirectory() = "";
+        } else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc) {
+            SIM_DT = atof(argv[++i]);
+            if (SIM_DT <= 0.0) {
+                printf("Invalid timestep: %s\n", argv[i]);
+                return false;
+            }
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+float stableTimestep(float dt) {
+    // The stencil scales the laplacian by csqrd * delta on a grid with spacing 1,
+    // which is stable in two dimensions as long as the product stays at or below 1/2.
+    float maxDt = 0.5 / CSQRD;
+    if (dt > maxDt) {
+        printf("Timestep %f violates the CFL condition, using %f\n", dt, maxDt);
+        return maxDt;
+    }
+    return dt;
+}
 
 void initializeSimulationData() {
     for (int i = 0; i < MAX_SOURCES; i++) {
-        Source* s = new Source(-1, -1, AMPLITUDE, FREQ);
+        Source* s = new Source(&sourceTable, -1, -1, AMPLITUDE, FREQ);
         s->setInactive();
         simData.sources[i] = s;
     }
 
+    // Rain drops are only ever touched through the table, they start parked outside.
+    simData.rainStart = sourceTable.size();
+    for (int i = 0; i < RAIN_DROPS; i++) {
+        sourceTable.add(-1, -1, 0.0, RAIN_FREQ);
+    }
+    srand(1);
+
     simData.src_counter = 0;
+    simData.steps = 0;
     simData.camPos[0] = simData.perspectives[simData.cur_perspective_idx][0];
     simData.camPos[1] = simData.perspectives[simData.cur_perspective_idx][1];
     simData.camPos[2] = simData.perspectives[simData.cur_perspective_idx][2];
@@ -111,44 +445,112 @@ void setNewCamPos(float* pos) {
     simData.camPos[2] = pos[2];
 }
 
-void saveImage(int width, int height, GLsizei nrChannels, unsigned char* data, GLsizei stride) {
-    stbi_write_png("screenshot.png", width, height, nrChannels, data, stride);
-    free(data);
-}
-
 void mixVec(float* v1, float* v2, float* res, float alpha, int size) {
     for (int i = 0; i < size; i++) {
         res[i] = v1[i] * (1 - alpha) + v2[i] * alpha;
     }
 }
 
-void saveFrame(GLFWwindow* window) {
-    // Saves a frame into the videorecording buffer
+void printPacingStats(const FramePacer& pacer) {
+    printf("Rendered %ld frames, %.2f ms apart on average, jitter %.3f ms", pacer.getFrames(),
+            1000.0 * pacer.averageInterval(), 1000.0 * pacer.jitter());
+    if (pacer.getPeriod() > 0.0) {
+        printf(" (%.3f ms worst), started %.1f us after the deadline on average, %ld deadlines missed",
+                1000.0 * pacer.worstJitter(), 1.0e6 * pacer.averageLateness(), pacer.getMissed());
+    }
+    printf("\n");
+}
 
-    int width, height;
-    glfwGetFramebufferSize(window, &width, &height);
-    GLsizei nrChannels = 3;
-    GLsizei stride = nrChannels * width;
-    stride += (stride % 4) ? (4 - stride % 4) : 0;
-    GLsizei frameBufferSize = stride * height;
-    // Check whether framebuffer needs to be increased in size
-    if (frameBufferSize + VideoRecording.offset > VideoRecording.memSize) {
-        // Reallocate
-        VideoRecording.memPtr = (unsigned char*) realloc(VideoRecording.memPtr, VideoRecording.memSize + 720*720*3*FPS);
-        VideoRecording.memSize = VideoRecording.memSize + 720*720*3*FPS;
+void printCaptureStats(const FrameCapture& capture) {
+    printf("Captured %ld frames of %dx%d, dropped %ld, latency %.2f ms (%.1f frames) average, %.2f ms worst\n",
+            capture.getCaptured(), capture.getWidth(), capture.getHeight(), capture.getDropped(),
+            1000.0 * capture.averageLatency(), capture.averageLatencyFrames(), 1000.0 * capture.maxLatency());
+}
+
+void printStreamStats(const VideoStream& stream) {
+    const StreamWriter* writer = stream.getWriter();
+    const ImageEncoder* encoder = stream.getEncoder();
+    if (writer != NULL) {
+        printf("Wrote %ld frames, %.1f MiB to %s%s, %ld writes waited for the disk, %ld frames dropped\n",
+                stream.getFrames(), writer->getBytesWritten() / (1024.0 * 1024.0), stream.getPath().c_str(),
+                writer->isDirect() ? " (O_DIRECT)" : "", writer->getStalls(), stream.getDropped());
+    } else if (encoder != NULL) {
+        printf("Wrote %ld images to %s/ on %d threads, %.1f ms per image, %ld waited for a thread, %ld frames dropped\n",
+                encoder->getEncoded(), stream.getPath().c_str(), encoder->getWorkers(),
+                1000.0 * encoder->averageEncodeTime(), encoder->getStalls(), stream.getDropped());
     }
+}
 
-    unsigned char* bufferPtr = VideoRecording.memPtr + VideoRecording.offset;
+glm::mat4 projectionMatrix(int width, int height) {
+    return glm::perspective(glm::radians(45.0f), (float) width / (float) height, 0.1f, 100.0f);
+}
 
-    glPixelStorei(GL_PACK_ALIGNMENT, 4);
-    glReadBuffer(GL_FRONT);
-    // Read pixels and put into video recording buffer.
-    glReadPixels(0,0,width,height,GL_RGB,GL_UNSIGNED_BYTE, bufferPtr);
-    VideoRecording.offset = VideoRecording.offset + frameBufferSize;
+void saveStill(const char* path) {
+    // Renders the current frame offscreen at the still size, independent of the
+    // window, and saves it in the background.
+    TRACE_ZONE("still");
+    int width = STILL_WIDTH > 0 ? STILL_WIDTH : WINDOW_WIDTH;
+    int height = STILL_HEIGHT > 0 ? STILL_HEIGHT : WINDOW_HEIGHT;
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    StillCapture still(width, height, SUPERSAMPLE);
+    if (!still.isComplete()) {
+        return;
+    }
+    printf("Rendering a %dx%d still, %dx%d supersampled, in %d tiles\n", width, height,
+            still.getSupersample(), still.getSupersample(), still.getTiles());
+    std::vector<unsigned char> rgb;
+    still.capture(projectionMatrix(width, height), [](const glm::mat4& projection) {
+        waveShader->use();
+        waveShader->setMat4("projection", projection);
+        glClearColor(1.0, 1.0, 1.0, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        render();
+    }, rgb);
+    waveShader->use();
+    waveShader->setMat4("projection", windowProjection);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    if (screenshotEncoder == NULL) {
+        screenshotEncoder = new ImageEncoder(IMAGE_PNG, 1, 2);
+    }
+    screenshotEncoder->submit(path, width, height, rgb.data(), true, true);
+}
 
+void recordFrame(GLFWwindow* window, FrameCapture*& capture, long frame) {
+    // Queues the back buffer for readback before it is presented. Frames which
+    // arrived meanwhile go to the videorecording stream, or are dropped if its
+    // writer is behind as the render loop must not wait for the disk.
+    // When the framebuffer changed size the capture is replaced.
+    TRACE_ZONE("record");
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    auto save = [&](long frame, const unsigned char* pixels, size_t size) {
+        (void) frame;
+        videoRecording->writeFrame(capture->getWidth(), capture->getHeight(), pixels, size, false);
+    };
+    if (capture != NULL && (capture->getWidth() != width || capture->getHeight() != height)) {
+        capture->finish(save);
+        printCaptureStats(*capture);
+        delete capture;
+        capture = NULL;
+    }
+    if (!videoRecording->accepts(width, height)) {
+        // A YUV4MPEG2 stream cannot change size.
+        return;
+    }
+    if (capture == NULL) {
+        capture = new FrameCapture(width, height, VideoStream::captureFormat(VIDEO_FORMAT), CAPTURE_SLOTS);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glReadBuffer(GL_BACK);
+    GpuZone zone(gpuProfiler, "capture");
+    capture->capture(frame, save);
 }
 
 void processInput(GLFWwindow* window) {
+    TRACE_ZONE("processInput");
     
     int left_mouse_button = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT);
     int right_mouse_button = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT);
@@ -182,25 +584,25 @@ void processInput(GLFWwindow* window) {
         simData.sources[simData.src_counter]->setInactive();
     }
 
-    if (inputState.prev_space == GLFW_RELEASE && spacebar == GLFW_PRESS) {
-        // Try to save image.
+    if (inputState.prev_space == GLFW_RELEASE && spacebar == GLFW_PRESS && (STILL_WIDTH > 0 || SUPERSAMPLE > 1)) {
+        saveStill("screenshot.png");
+    } else if (inputState.prev_space == GLFW_RELEASE && spacebar == GLFW_PRESS) {
+        // Try to save image. It is encoded in the background.
         printf("Saving Image\n");
         int width, height;
         glfwGetFramebufferSize(window, &width, &height);
-        GLsizei nrChannels = 3;
-        GLsizei stride = nrChannels * width;
-        stride += (stride % 4) ? (4 - stride % 4) : 0;
-        GLsizei bufferSize = stride * height;
-        printf("bufferSize: %d\n", bufferSize);
-        unsigned char* buffer = (unsigned char*) malloc(bufferSize);
-        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        std::vector<unsigned char> buffer((size_t) width * height * 3);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
         glReadBuffer(GL_FRONT);
-        glReadPixels(0,0,width,height,GL_RGB,GL_UNSIGNED_BYTE, buffer);
-        stbi_flip_vertically_on_write(true);
+        glReadPixels(0,0,width,height,GL_RGB,GL_UNSIGNED_BYTE, buffer.data());
 
-        // Lambda for thread
-        std::thread t(saveImage, width, height, nrChannels, buffer, stride);
-        t.detach();
+        if (screenshotEncoder == NULL) {
+            screenshotEncoder = new ImageEncoder(IMAGE_PNG, 1, 2);
+        }
+        if (!screenshotEncoder->submit("screenshot.png", width, height, buffer.data(), true, false)) {
+            printf("Still saving the previous images, skipped\n");
+        }
     }
 
 
@@ -233,6 +635,18 @@ void processInput(GLFWwindow* window) {
     inputState.prev_right_mouse = right_mouse_button;
     inputState.prev_left_mouse = left_mouse_button;
     inputState.prev_space = spacebar;
+
+    // Halves or doubles the grid, keeping its aspect ratio.
+    int grow = glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET);
+    int shrink = glfwGetKey(window, GLFW_KEY_LEFT_BRACKET);
+    if (inputState.prev_grow == GLFW_RELEASE && grow == GLFW_PRESS) {
+        resizeSimulation(2 * SIMULATION_WIDTH, 2 * SIMULATION_HEIGHT, PADDING);
+    }
+    if (inputState.prev_shrink == GLFW_RELEASE && shrink == GLFW_PRESS) {
+        resizeSimulation(SIMULATION_WIDTH / 2, SIMULATION_HEIGHT / 2, PADDING);
+    }
+    inputState.prev_grow = grow;
+    inputState.prev_shrink = shrink;
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
@@ -241,6 +655,62 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     WINDOW_HEIGHT = height;
 }
 
+void updateFrameUniforms(double time, float alpha) {
+    // Writes everything which changes once per frame with a single buffer update.
+    // alpha interpolates between the previous and the latest simulation state.
+    TRACE_ZONE("uniforms");
+    FrameUniforms frame;
+    glm::vec3 eye = glm::vec3(simData.camPos[0], simData.camPos[1], simData.camPos[2]);
+    frame.view = glm::lookAt(eye, glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0, 1.0, 0.0));
+    memcpy(frame.lightPos, simData.lightPos, 3 * sizeof(float));
+    frame.lightPos[3] = 1.0;
+    frame.time = (float) time;
+    frame.alpha = alpha;
+    glBindBuffer(GL_UNIFORM_BUFFER, glObjects.frameUniforms);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+}
+
+void benchmarkTileShapes() {
+    // Times the solver kernel for a range of workgroup shapes using GPU timer queries.
+    const int shapes[][2] = { {1, 1}, {8, 8}, {16, 16}, {32, 8}, {8, 32}, {32, 32} };
+    const int WARMUP_STEPS = 50;
+    const int TIMED_STEPS = 500;
+
+    int maxInvocations;
+    glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+
+    unsigned int query;
+    glGenQueries(1, &query);
+
+    // Without sources every step is a single dispatch of the stencil kernel.
+    SourceTable noSources;
+    printf("Solver kernel timing, %dx%d cells, %d steps per shape\n", SIMULATION_WIDTH, SIMULATION_HEIGHT, TIMED_STEPS);
+    printf("%-8s %12s %12s %10s\n", "tile", "us/step", "Mcells/s", "speedup");
+    double baseline = 0.0;
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        int tw = shapes[i][0], th = shapes[i][1];
+        if (tw * th > maxInvocations) {
+            printf("%3dx%-4d exceeds GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS (%d)\n", tw, th, maxInvocations);
+            continue;
+        }
+        GpuSolver gpu(SIMULATION_WIDTH, SIMULATION_HEIGHT, PADDING, CSQRD, tw, th, 1, HALF_PRECISION);
+        gpu.step(WARMUP_STEPS, SIM_DT, DAMPING, noSources);
+        glFinish();
+
+        GLuint64 elapsed;
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        gpu.step(TIMED_STEPS, SIM_DT, DAMPING, noSources);
+        glEndQuery(GL_TIME_ELAPSED);
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+
+        double usPerStep = elapsed / 1000.0 / TIMED_STEPS;
+        double mcells = (double) SIMULATION_WIDTH * SIMULATION_HEIGHT / usPerStep;
+        if (baseline == 0.0) baseline = usPerStep;
+        printf("%3dx%-4d %12.2f %12.1f %9.2fx\n", tw, th, usPerStep, mcells, baseline / usPerStep);
+    }
+    glDeleteQueries(1, &query);
+}
+
 double difference_in_sec(struct timespec* start, struct timespec* end) {
     double diff_in_seconds = ((double)end->tv_sec + 1.0e-9 * end->tv_nsec) - ((double) start->tv_sec + 1.0e-9 * start->tv_nsec);
     return diff_in_seconds;
@@ -255,6 +725,7 @@ void resetSources() {
 }
 
 void animate(int frame) {
+    TRACE_ZONE("animate");
     int ANIMATION_PERIOD = FPS * 400;
     int f = frame % ANIMATION_PERIOD;
     // 1 Centered source
@@ -425,118 +896,677 @@ void animate(int frame) {
 
 }
 
+void updateRain(long frame) {
+    // Every frame one batch of drops lands at a new position and the batch which
+    // landed half a lifetime ago fades out. Batches are consecutive in the source
+    // table, so each one is uploaded as a single range.
+    TRACE_ZONE("rain");
+    if (RAIN_DROPS == 0) {
+        return;
+    }
+    int batchSize = (RAIN_DROPS + RAIN_DROP_FRAMES - 1) / RAIN_DROP_FRAMES;
+    int landing = (int) (frame % RAIN_DROP_FRAMES) * batchSize;
+    int fading = (int) ((frame + RAIN_DROP_FRAMES / 2) % RAIN_DROP_FRAMES) * batchSize;
+    for (int i = landing; i < std::min(landing + batchSize, RAIN_DROPS); i++) {
+        SourceParams& p = sourceTable.edit(simData.rainStart + i);
+        p.x = rand() % SIMULATION_WIDTH;
+        p.y = rand() % SIMULATION_HEIGHT;
+        p.amplitude = RAIN_AMPLITUDE;
+        p.phase = 0.0;
+        p.epoch++;
+    }
+    for (int i = fading; i < std::min(fading + batchSize, RAIN_DROPS); i++) {
+        sourceTable.edit(simData.rainStart + i).amplitude = 0.0;
+    }
+}
+
+void advanceSimulation(int steps) {
+    // Takes the given number of fixed size steps. The scripted animation runs on
+    // simulated time: it is updated after every STEPS_PER_FRAME steps, which is one
+    // frame at the nominal frame rate.
+    TRACE_ZONE("simulate");
+    while (steps > 0) {
+        int n = std::min(steps, STEPS_PER_FRAME - (int) (simData.steps % STEPS_PER_FRAME));
+        {
+            TRACE_ZONE("step");
+            solver->step(n, SIM_DT, DAMPING, sourceTable);
+        }
+        simData.steps += n;
+        steps -= n;
+
+        if (simData.steps % STEPS_PER_FRAME == 0) {
+            animate(44 * FPS + simData.steps / STEPS_PER_FRAME - 1);
+            updateRain(simData.steps / STEPS_PER_FRAME);
+        }
+    }
+}
+
+double waveEnergy(const std::vector<float>& cur, const std::vector<float>& prev, int w, int h) {
+    // Discrete energy conserved by the leapfrog scheme without damping and sources:
+    // kinetic 1/2 (h_n - h_n-1)^2 plus potential 1/2 csqrd delta grad(h_n) . grad(h_n-1).
+    double k = CSQRD * SIM_DT;
+    double energy = 0.0;
+    for (int y = 0; y < h - 1; y++) {
+        for (int x = 0; x < w - 1; x++) {
+            int i = x + y * w;
+            double v = cur[i] - prev[i];
+            double gx = (cur[i + 1] - cur[i]) * (prev[i + 1] - prev[i]);
+            double gy = (cur[i + w] - cur[i]) * (prev[i + w] - prev[i]);
+            energy += 0.5 * v * v + 0.5 * k * (gx + gy);
+        }
+    }
+    return energy;
+}
+
+void resetToSingleSource() {
+    // Silences all sources and rain but a single source in the center. The solvers
+    // have to be reset as well to restart from rest.
+    for (int i = 0; i < sourceTable.size(); i++) {
+        SourceParams& p = sourceTable.edit(i);
+        p.x = -1;
+        p.y = -1;
+        p.amplitude = 0.0;
+        p.freq = FREQ;
+    }
+    simData.sources[0]->setPos(SIMULATION_WIDTH / 2, SIMULATION_HEIGHT / 2);
+    simData.sources[0]->setAmplitude(AMPLITUDE);
+    simData.sources[0]->setActive();
+}
+
+std::vector<std::vector<float> > runPrecisionTest(bool halfPrecision, int checkpoints, int interval) {
+    // Runs the solver from rest with a single source in the center and returns
+    // the latest and previous heights at every checkpoint.
+    GpuSolver gpu(SIMULATION_WIDTH, SIMULATION_HEIGHT, PADDING, CSQRD, TILE_WIDTH, TILE_HEIGHT, 1, halfPrecision);
+    resetToSingleSource();
+
+    std::vector<std::vector<float> > snapshots(2 * checkpoints);
+    for (int c = 0; c < checkpoints; c++) {
+        gpu.step(interval, SIM_DT, DAMPING, sourceTable);
+        gpu.readHeights(true, snapshots[2 * c]);
+        gpu.readHeights(false, snapshots[2 * c + 1]);
+    }
+    return snapshots;
+}
+
+void comparePrecision() {
+    // Runs identical simulations with fp32 and fp16 storage and reports how far
+    // the half precision run drifts from the single precision one.
+    const int CHECKPOINTS = 10;
+    const int INTERVAL = 600;
+    DAMPING = 0.0;
+    int w = SIMULATION_WIDTH + 2 * PADDING, rows = SIMULATION_HEIGHT + 2 * PADDING;
+
+    std::vector<std::vector<float> > full = runPrecisionTest(false, CHECKPOINTS, INTERVAL);
+    std::vector<std::vector<float> > half = runPrecisionTest(true, CHECKPOINTS, INTERVAL);
+
+    printf("fp16 against fp32 storage, %dx%d cells, one source, no damping\n", SIMULATION_WIDTH, SIMULATION_HEIGHT);
+    printf("%8s %14s %14s %12s %12s %12s\n", "step", "energy fp32", "energy fp16", "energy err", "rms err", "max err");
+    for (int c = 0; c < CHECKPOINTS; c++) {
+        const std::vector<float>& f = full[2 * c];
+        const std::vector<float>& h = half[2 * c];
+        double e32 = waveEnergy(f, full[2 * c + 1], w, rows);
+        double e16 = waveEnergy(h, half[2 * c + 1], w, rows);
+        double sumSq = 0.0, maxErr = 0.0;
+        for (size_t i = 0; i < f.size(); i++) {
+            double d = fabs(h[i] - f[i]);
+            sumSq += d * d;
+            maxErr = fmax(maxErr, d);
+        }
+        printf("%8d %14.6e %14.6e %11.4f%% %12.4e %12.4e\n", (c + 1) * INTERVAL, e32, e16,
+                100.0 * (e16 - e32) / e32, sqrt(sumSq / f.size()), maxErr);
+    }
+}
+
+void benchmarkCpuKernels() {
+    // Times the CPU solver for every supported instruction set on the simulation grid,
+    // which stays in cache, and on a grid which does not, and checks every kernel
+    // against the scalar one. Needs no GPU.
+    const int sizes[] = { SIMULATION_WIDTH, 2048 };
+    const double CELL_UPDATES = 4e8;
+    // Per cell the step reads the latest height and reads and writes the previous one,
+    // the neighbouring rows of the latest heights are assumed to come from cache.
+    const double BYTES_PER_CELL = 3 * sizeof(float);
+
+    printf("%-8s %6s %6s %10s %10s %8s %12s\n", "isa", "grid", "steps", "ms/step", "Mcells/s", "GB/s", "max diff");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int n = sizes[s];
+        int steps = std::max(10, (int) (CELL_UPDATES / ((double) n * n)));
+        SourceTable sources;
+        Source center(&sources, n / 2, n / 2, AMPLITUDE, FREQ);
+
+        std::vector<float> reference;
+        for (int i = 0; i < CPU_ISA_COUNT; i++) {
+            CpuIsa isa = (CpuIsa) i;
+            if (!cpuIsaSupported(isa)) {
+                printf("%-8s %6d not supported by this CPU\n", cpuIsaName(isa), n);
+                continue;
+            }
+            CpuSolver solver(n, n, PADDING, CSQRD, isa);
+            if (!solver.isValid()) {
+                break;
+            }
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            solver.step(steps, SIM_DT, DAMPING, sources);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double seconds = difference_in_sec(&start, &end);
+
+            const float* h = solver.latestHeights();
+            std::vector<float> result(h, h + solver.getStride() * solver.getRows());
+            if (isa == CPU_ISA_SCALAR) {
+                reference = result;
+            }
+            double maxDiff = 0.0;
+            for (size_t c = 0; c < result.size(); c++) {
+                maxDiff = fmax(maxDiff, fabs(result[c] - reference[c]));
+            }
+            double cells = (double) n * n * steps;
+            printf("%-8s %6d %6d %10.3f %10.1f %8.2f %12.4e\n", cpuIsaName(isa), n, steps,
+                    1000.0 * seconds / steps, cells / seconds / 1e6, cells * BYTES_PER_CELL / seconds / 1e9, maxDiff);
+        }
+    }
+}
+
+void benchmarkCpuScaling() {
+    // Reports steps per second and memory throughput of the CPU solver for a grid
+    // which fits into the caches and two which do not, against the thread count.
+    const int sizes[] = { 256, 2048, 8192 };
+    const double CELL_UPDATES = 2e9;
+    const double BYTES_PER_CELL = 3 * sizeof(float);
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> threadCounts;
+    for (int t = 1; t < cores; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(cores);
+
+    printf("CPU solver scaling (%s, time block %d), %d cores\n", cpuIsaName(CPU_ISA), CPU_TIME_BLOCK, cores);
+    printf("%6s %8s %6s %12s %10s %8s %8s\n", "grid", "threads", "steps", "steps/s", "Mcells/s", "GB/s", "speedup");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int n = sizes[s];
+        int steps = std::max(10, (int) (CELL_UPDATES / ((double) n * n)));
+        SourceTable sources;
+        Source center(&sources, n / 2, n / 2, AMPLITUDE, FREQ);
+        double single = 0.0;
+        for (size_t t = 0; t < threadCounts.size(); t++) {
+            CpuSolver solver(n, n, PADDING, CSQRD, CPU_ISA, threadCounts[t], CPU_TIME_BLOCK);
+            if (!solver.isValid()) {
+                break;
+            }
+            // One untimed block to fault in the pages and start the threads.
+            solver.step(CPU_TIME_BLOCK, SIM_DT, DAMPING, sources);
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            solver.step(steps, SIM_DT, DAMPING, sources);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double seconds = difference_in_sec(&start, &end);
+            double cells = (double) n * n * steps;
+            if (t == 0) single = seconds;
+            printf("%6d %8d %6d %12.1f %10.1f %8.2f %7.2fx\n", n, threadCounts[t], steps, steps / seconds,
+                    cells / seconds / 1e6, cells * BYTES_PER_CELL / seconds / 1e9, single / seconds);
+        }
+    }
+}
+
+void benchmarkCpuTimeBlocking() {
+    // Reports the throughput of the CPU solver on grids which do not fit into the
+    // caches against the number of fused steps, and the difference to the unblocked run.
+    const int sizes[] = { 2048, 8192 };
+    const int depths[] = { 1, 2, 4, 8, 16 };
+    const int STEPS = 64; // multiple of every depth
+
+    printf("CPU solver temporal blocking (%s, %d threads)\n", cpuIsaName(CPU_ISA), CPU_THREADS);
+    printf("%6s %6s %10s %10s %8s %12s\n", "grid", "depth", "steps/s", "Mcells/s", "speedup", "max diff");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int n = sizes[s];
+        SourceTable sources;
+        Source center(&sources, n / 2, n / 2, AMPLITUDE, FREQ);
+        std::vector<float> reference;
+        double unblocked = 0.0;
+        for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+            CpuSolver solver(n, n, PADDING, CSQRD, CPU_ISA, CPU_THREADS, depths[d]);
+            if (!solver.isValid()) {
+                break;
+            }
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            solver.step(STEPS, SIM_DT, DAMPING, sources);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double seconds = difference_in_sec(&start, &end);
+
+            const float* h = solver.latestHeights();
+            std::vector<float> result(h, h + solver.getStride() * solver.getRows());
+            if (d == 0) {
+                reference = result;
+                unblocked = seconds;
+            }
+            double maxDiff = 0.0;
+            for (size_t c = 0; c < result.size(); c++) {
+                maxDiff = fmax(maxDiff, fabs(result[c] - reference[c]));
+            }
+            printf("%6d %6d %10.1f %10.1f %7.2fx %12.4e\n", n, depths[d], STEPS / seconds,
+                    (double) n * n * STEPS / seconds / 1e6, unblocked / seconds, maxDiff);
+        }
+    }
+}
+
+void verifyCpuSolver() {
+    // Runs the GPU and the CPU solver side by side from rest with a single source.
+    // The GPU may contract multiply-adds and its sin differs from libm, so the
+    // results agree within a tolerance rather than bit for bit. The reference
+    // takes single steps in fp32 whatever --time-block and --fp16 say, the blocked
+    // kernel holds the source amplitude within a block and fp16 rounds the heights.
+    const int CHECKPOINTS = 10;
+    const int INTERVAL = 100;
+    const float TOLERANCE = 1e-3;
+
+    resetToSingleSource();
+    GpuSolver gpu(SIMULATION_WIDTH, SIMULATION_HEIGHT, PADDING, CSQRD, TILE_WIDTH, TILE_HEIGHT, 1, false);
+    CpuSolver cpu(SIMULATION_WIDTH, SIMULATION_HEIGHT, PADDING, CSQRD, CPU_ISA, CPU_THREADS, CPU_TIME_BLOCK);
+    if (!cpu.isValid()) {
+        return;
+    }
+
+    printf("GPU against CPU (%s, %d threads) solver, %dx%d cells, one source\n", cpuIsaName(cpu.getIsa()), cpu.getThreads(),
+            SIMULATION_WIDTH, SIMULATION_HEIGHT);
+    printf("%8s %12s %12s %12s\n", "step", "max height", "max diff", "rms diff");
+    bool pass = true;
+    std::vector<float> g;
+    for (int c = 0; c < CHECKPOINTS; c++) {
+        gpu.step(INTERVAL, SIM_DT, DAMPING, sourceTable);
+        cpu.step(INTERVAL, SIM_DT, DAMPING, sourceTable);
+        gpu.readHeights(true, g);
+        const float* h = cpu.latestHeights();
+        double maxHeight = 0.0, maxDiff = 0.0, sumSq = 0.0;
+        for (size_t i = 0; i < g.size(); i++) {
+            double d = fabs(g[i] - h[i]);
+            maxHeight = fmax(maxHeight, fabs(h[i]));
+            maxDiff = fmax(maxDiff, d);
+            sumSq += d * d;
+        }
+        pass = pass && maxDiff <= TOLERANCE * fmax(maxHeight, 1.0);
+        printf("%8d %12.4e %12.4e %12.4e\n", (c + 1) * INTERVAL, maxHeight, maxDiff, sqrt(sumSq / g.size()));
+    }
+    printf("%s\n", pass ? "CPU and GPU solver agree" : "CPU and GPU solver differ beyond the tolerance");
+}
+
 void mainloop(GLFWwindow* window) {
     // The main render loop
     struct timespec clock;
     clock_gettime(CLOCK_MONOTONIC, &clock);
 
     clock_gettime(CLOCK_MONOTONIC, &clock);
-    double time = glfwGetTime();
-    double prevTime = time;
-    double deltaTime;
     double timeSinceStart = 0.0;
-    int frames =  44 * FPS;
     int recordingFrames = 0;
+    FrameCapture* capture = NULL;
+    if (RECORD_VIDEO) {
+        // Image sequences go into the directory videorecording/.
+        std::string path = "videorecording";
+        if (!VideoStream::isImageSequence(VIDEO_FORMAT)) {
+            path = path + "." + VideoStream::extension(VIDEO_FORMAT);
+        }
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        videoRecording = new VideoStream(path.c_str(), VIDEO_FORMAT, width, height, FPS, ENCODE_WORKERS, ENCODE_QUEUE);
+        if (!videoRecording->isOpen()) {
+            delete videoRecording;
+            videoRecording = NULL;
+            RECORD_VIDEO = false;
+        }
+    }
+
+    // One frame at the nominal frame rate takes STEPS_PER_FRAME steps.
+    SimulationClock simClock(1.0 / ((double) FPS * STEPS_PER_FRAME), MAX_CATCHUP_FRAMES * STEPS_PER_FRAME);
+
+    FramePacer pacer(VSYNC || DISPLAY_FPS == 0.0 ? 0.0 : 1.0 / DISPLAY_FPS);
+    double lastSummary = glfwGetTime();
 
     while(!glfwWindowShouldClose(window)) {
 
-        time = glfwGetTime();
-
-        if (time - prevTime >= (1.0 / (float) FPS)) {
-
-            glfwPollEvents();
-            processInput(window);
-
-            deltaTime = time - prevTime;
-            prevTime = time;
-            timeSinceStart += deltaTime;
-
-            glfwMakeContextCurrent(window);
-
-            glClearColor(1.0, 1.0, 1.0, 1.0f);
-            //glClear(GL_COLOR_BUFFER_BIT);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-
-            for (int i = 0; i < 1; i++){
-                // Compute Shader
-
-                // Initialize data for compute shader.
-                int sourcePos[MAX_SOURCES][2];
-                float phase[MAX_SOURCES];
-                float amps[MAX_SOURCES];
-                float freqs[MAX_SOURCES];
-
-                for (int s = 0; s < MAX_SOURCES; s++) {
-                    simData.sources[s]->update(deltaTime);
-                    SourcePos pos = simData.sources[s]->getPos();
-                    sourcePos[s][0] = pos.x;
-                    sourcePos[s][1] = pos.y;
-                    phase[s] = simData.sources[s]->getPhase();
-                    amps[s] = simData.sources[s]->getAmplitude();
-                    freqs[s] = simData.sources[s]->getFreq();
-                }
-
-                {
-                    computeShader->use();
-                    // Setup uniform variables, which change every iteration.
-                    computeShader->setFloat("time", time);
-                    computeShader->setFloat("delta", deltaTime);
-                    computeShader->setFloat("damping", DAMPING);
-                    // Sources uniform
-                    computeShader->setVec2iArray("sources", MAX_SOURCES, sourcePos);
-
-                    //int loc = glGetUniformLocation(computeProgram.ID, "sources");
-                    //const GLint* ptr = (const GLint*) simData.sources;
-                    //glUniform2iv(loc, MAX_SOURCES, ptr);
-                    //loc = glGetUniformLocation(computeProgram.ID, "source_phases");
-                    //if (loc < 0) {
-                    //    printf("Could not find uniform source_phases\n");
-                    //}
-                    computeShader->setFloatArray("source_phases", MAX_SOURCES, phase);
-                    computeShader->setFloatArray("source_amplitude", MAX_SOURCES, amps);
-                    computeShader->setFloatArray("source_freq", MAX_SOURCES, freqs);
-
-                    // Dispatch the shader.
-                    glDispatchCompute(SIMULATION_WIDTH, SIMULATION_HEIGHT, 1);
-                    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-
-                    prevTime = time;
-                }
-
-                // Copy Compute Shader
-                {
-                    // This switches around some values in order to have everything ready for the next compute shader pass.
-                    copyShader->use();
-                    glDispatchCompute(SIMULATION_WIDTH, SIMULATION_HEIGHT, 1);
-                    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-                }
-            }
-
-            // Update
-            animate(frames);
-
-            // Render
-            render(time);
+        // Sleeps until the frame is due, handling window events as they arrive.
+        double deltaTime;
+        {
+            TRACE_ZONE("wait");
+            deltaTime = pacer.wait([](double seconds) { glfwWaitEventsTimeout(seconds); });
+        }
+        TRACE_ZONE("frame");
+        double time = glfwGetTime();
+
+        glfwPollEvents();
+        processInput(window);
+        if (solver == NULL) {
+            break; // a failed resize left no solver
+        }
+
+        timeSinceStart += deltaTime;
+
+        glfwMakeContextCurrent(window);
+        if (gpuProfiler != NULL) {
+            gpuProfiler->beginFrame();
+            if (GPU_PROFILE && time - lastSummary >= 1.0) {
+                glfwSetWindowTitle(window, gpuProfiler->summary().c_str());
+                lastSummary = time;
+            }
+        }
+
+        glClearColor(1.0, 1.0, 1.0, 1.0f);
+        //glClear(GL_COLOR_BUFFER_BIT);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+
+        // Compute Shader and Update
+        int steps = simClock.advance(deltaTime);
+        updateFrameUniforms(time, simClock.alpha());
+        advanceSimulation(steps);
+
+        // Render
+        render();
+
+        // Save frame
+        if (RECORD_VIDEO) recordFrame(window, capture, recordingFrames);
+        {
+            TRACE_ZONE("swap");
             glfwSwapBuffers(window);
-            frames++;
-            recordingFrames++;
+        }
+        recordingFrames++;
+    }
+
+    if (capture != NULL) {
+        capture->finish([&](long frame, const unsigned char* pixels, size_t size) {
+            (void) frame;
+            videoRecording->writeFrame(capture->getWidth(), capture->getHeight(), pixels, size, true);
+        });
+        printCaptureStats(*capture);
+        delete capture;
+    }
+    if (videoRecording != NULL) {
+        videoRecording->close();
+        printStreamStats(*videoRecording);
+        delete videoRecording;
+        videoRecording = NULL;
+    }
+    // Waits for screenshots which are still being written.
+    delete screenshotEncoder;
+    screenshotEncoder = NULL;
+
+    printf("Simulated %ld steps, dropped %ld steps to keep up\n", simData.steps, simClock.getDroppedSteps());
+    printPacingStats(pacer);
+    if (gpuProfiler != NULL) {
+        gpuProfiler->flush();
+        if (GPU_PROFILE) gpuProfiler->report();
+    }
+}
+
+void createHeightStream() {
+    // Textures for a solver which keeps its heights in host memory.
+    int w = solver->getStride(), h = solver->getRows();
+    for (int i = 0; i < 2; i++) {
+        glObjects.streamed[i] = createHeightTexture(w, h, GL_R32F, solver->hostHeights(i == 0));
+    }
+    glGenBuffers(1, &glObjects.heightUpload);
+    glObjects.streamedSteps = simData.steps;
+}
+
+int meshResolution() {
+    return MESH_N > 0 ? MESH_N : std::min(std::max(SIMULATION_WIDTH, SIMULATION_HEIGHT), MESH_MAX_N);
+}
+
+void createMesh(int N) {
+    // Fills the vertex and index buffers of the surface with an N x N plane whose
+    // texture coordinates span the heights, creating them on the first call.
+    std::vector<float> vertices((size_t) 5 * N * N);
+    std::vector<unsigned int> indices((size_t) 3 * 2 * (N - 1) * (N - 1));
+    generatePlane(N, 10, vertices.data(), indices.data());
+    glObjects.PLANE_N = N;
+
+    if (glObjects.VAO == 0) {
+        glGenVertexArrays(1, &glObjects.VAO);
+        glGenBuffers(1, &glObjects.meshVertices);
+        glGenBuffers(1, &glObjects.meshIndices);
+    }
+    glBindVertexArray(glObjects.VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, glObjects.meshVertices);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
 
-            // Save frame
-            if (RECORD_VIDEO) saveFrame(window);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glObjects.meshIndices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+
+    glBindVertexArray(0);
+}
+
+bool createSolver() {
+    // The heights are surrounded by PADDING cells which stay zero and serve as
+    // the boundary condition for the wave simulation. Returns false, leaving
+    // solver NULL, if the CPU solver could not allocate its heights.
+    if (USE_CPU_SOLVER) {
+        CpuSolver* cpu = new CpuSolver(SIMULATION_WIDTH, SIMULATION_HEIGHT, PADDING, CSQRD, CPU_ISA, CPU_THREADS, CPU_TIME_BLOCK);
+        if (!cpu->isValid()) {
+            delete cpu;
+            return false;
         }
+        printf("Created CPU solver (%s, %d threads, time block %d)\n", cpuIsaName(cpu->getIsa()), cpu->getThreads(), cpu->getTimeBlock());
+        solver = cpu;
+        createHeightStream();
+    } else {
+        GpuSolver* gpu = new GpuSolver(SIMULATION_WIDTH, SIMULATION_HEIGHT, PADDING, CSQRD, TILE_WIDTH, TILE_HEIGHT, TIME_BLOCK, HALF_PRECISION);
+        printf("Created GPU solver (tile %dx%d, time block %d)\n", TILE_WIDTH, TILE_HEIGHT, gpu->getTimeBlock());
+        solver = gpu;
+        gpu->setProfiler(gpuProfiler);
     }
+    return true;
+}
 
-    if (RECORD_VIDEO) {
-        // Write videorecording buffer to file
-        FILE* fd = fopen("videorecording.raw", "w");
-        if (fd == NULL) {
-            printf("Could not open/create videorecording file");
+void destroySolver() {
+    if (solver->heightTexture(true) == 0) {
+        glDeleteTextures(2, glObjects.streamed);
+        glDeleteBuffers(1, &glObjects.heightUpload);
+    }
+    delete solver;
+    solver = NULL;
+}
+
+bool glOutOfMemory() {
+    // Drains the error queue, an out of memory error may be queued behind others.
+    bool outOfMemory = false;
+    for (GLenum error = glGetError(); error != GL_NO_ERROR; error = glGetError()) {
+        outOfMemory = outOfMemory || error == GL_OUT_OF_MEMORY;
+    }
+    return outOfMemory;
+}
+
+bool resizeSimulation(int width, int height, int padding) {
+    // Replaces the solver, and the mesh if it follows the grid, while the program
+    // runs. The surface restarts at rest, sources keep their place relative to the
+    // grid. If the new grid does not fit into memory the old one is restored, if
+    // that fails too solver is left NULL and the main loop ends.
+    TRACE_ZONE("resize");
+    int maxSize;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if (width < MIN_GRID_SIZE || height < MIN_GRID_SIZE || width + 2 * padding > maxSize || height + 2 * padding > maxSize) {
+        printf("Grid %dx%d with padding %d is outside of %d to %d cells\n", width, height, padding,
+                MIN_GRID_SIZE, maxSize - 2 * padding);
+        return false;
+    }
+    int oldWidth = SIMULATION_WIDTH, oldHeight = SIMULATION_HEIGHT, oldPadding = PADDING;
+    // The old solver goes first, so both never take up memory at the same time.
+    destroySolver();
+    glOutOfMemory();
+    SIMULATION_WIDTH = width;
+    SIMULATION_HEIGHT = height;
+    PADDING = padding;
+    bool created = createSolver();
+    if (glOutOfMemory() || !created) {
+        printf("Out of memory for a grid of %dx%d, keeping %dx%d\n", width, height, oldWidth, oldHeight);
+        if (solver != NULL) {
+            destroySolver();
+        }
+        SIMULATION_WIDTH = oldWidth;
+        SIMULATION_HEIGHT = oldHeight;
+        PADDING = oldPadding;
+        created = createSolver();
+        if (glOutOfMemory() || !created) {
+            printf("Could not restore the grid of %dx%d either, exiting\n", oldWidth, oldHeight);
+            if (solver != NULL) {
+                destroySolver();
+            }
         }
-        fwrite(VideoRecording.memPtr, 1, VideoRecording.offset, fd);
-        fclose(fd);
+        return false;
     }
-    
+
+    for (int i = 0; i < sourceTable.size(); i++) {
+        const SourceParams& p = sourceTable.get(i);
+        if (p.x < 0 || p.y < 0) {
+            continue; // parked
+        }
+        SourceParams& moved = sourceTable.edit(i);
+        moved.x = std::min((int) ((long) p.x * width / oldWidth), width - 1);
+        moved.y = std::min((int) ((long) p.y * height / oldHeight), height - 1);
+    }
+    if (MESH_N == 0) {
+        createMesh(meshResolution());
+    }
+    waveShader->use();
+    waveShader->setVec2i("SIM_SIZE", SIMULATION_WIDTH, SIMULATION_HEIGHT);
+    printf("Simulating %dx%d cells with padding %d, mesh %dx%d\n", SIMULATION_WIDTH, SIMULATION_HEIGHT, PADDING,
+            glObjects.PLANE_N, glObjects.PLANE_N);
+    return true;
+}
+
+void uploadHeights(unsigned int tex, const float* heights) {
+    // The pixel buffer is orphaned before every upload, so the driver hands out
+    // fresh memory instead of waiting for the transfer of the last upload.
+    int w = solver->getStride(), h = solver->getRows();
+    size_t size = (size_t) w * h * sizeof(float);
+    GpuZone zone(gpuProfiler, "upload");
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, glObjects.heightUpload);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    memcpy(dst, heights, size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RED, GL_FLOAT, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void streamHeights() {
+    // Brings the streamed textures up to date with the solver. After a single
+    // step the old latest heights are the new previous ones, so only one upload is needed.
+    long steps = simData.steps - glObjects.streamedSteps;
+    if (steps == 0) {
+        return;
+    }
+    if (steps == 1) {
+        std::swap(glObjects.streamed[0], glObjects.streamed[1]);
+    } else {
+        uploadHeights(glObjects.streamed[1], solver->hostHeights(false));
+    }
+    uploadHeights(glObjects.streamed[0], solver->hostHeights(true));
+    glObjects.streamedSteps = simData.steps;
+}
+
+void bindHeights() {
+    // The wave shader samples the previous heights from texture unit 0 and the
+    // latest heights from texture unit 1.
+    unsigned int latest = solver->heightTexture(true), previous = solver->heightTexture(false);
+    if (latest == 0) {
+        streamHeights();
+        latest = glObjects.streamed[0];
+        previous = glObjects.streamed[1];
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, previous);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, latest);
+}
+
+bool renderOffline() {
+    // Renders OFFLINE_FRAMES frames into an offscreen target as fast as possible.
+    // Every frame advances the simulation by exactly STEPS_PER_FRAME steps of SIM_DT,
+    // so the output does not depend on how long a frame takes to render.
+    if (WINDOW_WIDTH > RenderTarget::maxSize() || WINDOW_HEIGHT > RenderTarget::maxSize()) {
+        printf("Offline size %dx%d exceeds the maximum of %d\n", WINDOW_WIDTH, WINDOW_HEIGHT, RenderTarget::maxSize());
+        return false;
+    }
+    RenderTarget target(WINDOW_WIDTH, WINDOW_HEIGHT, 4);
+    if (!target.isComplete()) {
+        return false;
+    }
+    VideoStream* out = NULL;
+    if (OFFLINE_OUTPUT != NULL) {
+        out = new VideoStream(OFFLINE_OUTPUT, VIDEO_FORMAT, WINDOW_WIDTH, WINDOW_HEIGHT, FPS, ENCODE_WORKERS, ENCODE_QUEUE);
+        if (!out->isOpen()) {
+            delete out;
+            return false;
+        }
+    }
+    // No frame may be lost, so a full ring waits for the oldest frame instead of
+    // dropping, and so does the writer when the disk is behind.
+    FrameCapture capture(WINDOW_WIDTH, WINDOW_HEIGHT, VideoStream::captureFormat(VIDEO_FORMAT), CAPTURE_SLOTS, false);
+    auto write = [&](long frame, const unsigned char* pixels, size_t size) {
+        (void) frame;
+        out->writeFrame(WINDOW_WIDTH, WINDOW_HEIGHT, pixels, size, true);
+    };
+
+    printf("Rendering %ld frames of %dx%d (%dx MSAA), %d steps per frame\n", OFFLINE_FRAMES,
+            WINDOW_WIDTH, WINDOW_HEIGHT, target.getSamples(), STEPS_PER_FRAME);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long frame = 0; frame < OFFLINE_FRAMES; frame++) {
+        TRACE_ZONE("frame");
+        if (gpuProfiler != NULL) gpuProfiler->beginFrame();
+        // The frame shows the latest heights, there is nothing to interpolate.
+        updateFrameUniforms((double) frame / FPS, 1.0);
+        advanceSimulation(STEPS_PER_FRAME);
+
+        target.bind();
+        glClearColor(1.0, 1.0, 1.0, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        render();
+
+        if (out != NULL) {
+            target.bindForReading();
+            GpuZone zone(gpuProfiler, "capture");
+            capture.capture(frame, write);
+        }
+    }
+    if (out != NULL) {
+        capture.finish(write);
+        out->close();
+    }
+    glFinish();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    double seconds = difference_in_sec(&start, &end);
+    printf("Rendered %ld frames in %.2f s, %.1f frames/s, %.2fx realtime at %d FPS\n", OFFLINE_FRAMES, seconds,
+            OFFLINE_FRAMES / seconds, OFFLINE_FRAMES / seconds / FPS, FPS);
+    if (gpuProfiler != NULL) {
+        gpuProfiler->flush();
+        if (GPU_PROFILE) gpuProfiler->report();
+    }
+    if (STILL_WIDTH > 0 || SUPERSAMPLE > 1) {
+        // Keeps the last frame as a still.
+        saveStill("screenshot.png");
+        delete screenshotEncoder;
+        screenshotEncoder = NULL;
+    }
+    if (out != NULL) {
+        printCaptureStats(capture);
+        printStreamStats(*out);
+        bool ok = out->close();
+        delete out;
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
 }
 
 void renderLightSource() {
@@ -550,15 +1580,13 @@ void renderLightSource() {
     glDrawArrays(GL_TRIANGLES, 0, 36);
 }
 
-void render(double time) {
+void render() {
+        TRACE_ZONE("render");
+        GpuZone zone(gpuProfiler, "render");
+        // View, light and interpolation factor come from the frame uniforms.
+        bindHeights();
         waveShader->use();
 
-        glm::vec3 eye = glm::vec3(simData.camPos[0], simData.camPos[1], simData.camPos[2]);
-        glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0, 1.0, 0.0));
-        waveShader->setMat4("view", view);
-        waveShader->setFloat("time", (float) time);
-        waveShader->setVec3("lightPos", simData.lightPos[0], simData.lightPos[1], simData.lightPos[2]);
-
         glBindVertexArray(glObjects.VAO);
 
         // TODO: make neat.
@@ -573,37 +1601,87 @@ void render(double time) {
 }
 
 
-int main() {
+void closeContext(GLFWwindow* window) {
+    // The programs are deleted with the shaders, which needs the context.
+    delete waveShader;
+    delete lightShader;
+    waveShader = NULL;
+    lightShader = NULL;
+    if (window != NULL) {
+        glfwTerminate();
+    } else {
+        destroyOfflineContext();
+    }
+}
 
-    initializeSimulationData();
-    
-    // Initialize videorecording struct
-    if (RECORD_VIDEO) {
-        VideoRecording.offset = 0;
-        VideoRecording.memPtr = (unsigned char*) malloc(720*720*3*FPS);
-        VideoRecording.memSize = 720*720*3*FPS; // First second
-    }
-
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_SAMPLES, 4);
-    glfwWindowHint(GLFW_DEPTH_BITS, 32);
-    glfwWindowHint(GLFW_REFRESH_RATE, 60);
-
-    GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "LearnOpenGl", NULL, NULL);
-    if (window == NULL) {
-        printf("Failed to create GLFW window");
+int main(int argc, char** argv) {
+
+    if (!parseArguments(argc, argv)) {
         return -1;
     }
-    glfwMakeContextCurrent(window);
-    //
-    // Setup Dear ImGui
+    if (TRACE_FILE != NULL) {
+        Trace::setThreadName("main");
+        Trace::start(TRACE_EVENTS);
+    }
 
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)){
-        printf("Failed to initialize GLAD");
-        return -1;
+    initializeSimulationData();
+    SIM_DT = stableTimestep(SIM_DT);
+    if (CPU_ISA == CPU_ISA_COUNT) {
+        CPU_ISA = bestCpuIsa();
+    }
+    if (CPU_THREADS == 0) {
+        CPU_THREADS = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (ENCODE_WORKERS == 0) {
+        ENCODE_WORKERS = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (ENCODE_QUEUE == 0) {
+        ENCODE_QUEUE = 2 * ENCODE_WORKERS;
+    }
+
+    if (CPU_BENCH) {
+        benchmarkCpuKernels();
+        return 0;
+    }
+    if (CPU_SCALING) {
+        benchmarkCpuScaling();
+        return 0;
+    }
+    if (CPU_BLOCKING) {
+        benchmarkCpuTimeBlocking();
+        return 0;
+    }
+    
+    GLFWwindow* window = NULL;
+    if (OFFLINE_FRAMES > 0) {
+        if (!createOfflineContext()) {
+            return -1;
+        }
+    } else {
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_SAMPLES, 4);
+        glfwWindowHint(GLFW_DEPTH_BITS, 32);
+        glfwWindowHint(GLFW_REFRESH_RATE, 60);
+
+        window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "LearnOpenGl", NULL, NULL);
+        if (window == NULL) {
+            printf("Failed to create GLFW window");
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+        //
+        // Setup Dear ImGui
+
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)){
+            printf("Failed to initialize GLAD");
+            return -1;
+        }
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        // Without vsync the frame pacer sets the rate, which a variable refresh display follows.
+        glfwSwapInterval(VSYNC ? 1 : 0);
     }
 
 
@@ -614,8 +1692,6 @@ int main() {
     glDepthMask(GL_TRUE);
     glDepthFunc(GL_LESS);
 
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-
 
 
     // Set up vertex data and configure attributes
@@ -663,31 +1739,7 @@ int main() {
         -0.5f,  0.5f, -0.5f
     };
 
-    int N = 200;
-    glObjects.PLANE_N = N;
-    float meshv[5*N*N];
-    unsigned int meshi[3*2*(N-1)*(N-1)];
-    generatePlane(N, 10, meshv, meshi);
-
-    // Setup Vertex Array, Vertex Buffer and Element Buffer Objects
-    unsigned int VAO, VBO, EBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-
-    glBindVertexArray(VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(meshv), meshv, GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(meshi), meshi, GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    createMesh(meshResolution());
 
     // Setup light source info.
     unsigned int LightVBO, LightVAO;
@@ -708,51 +1760,39 @@ int main() {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-    Shader s("./src/shaders/compute/vertex.glsl", "./src/shaders/compute/fragment.glsl");
-    waveShader = &s;
+    waveShader = new Shader("./src/shaders/compute/vertex.glsl", "./src/shaders/compute/fragment.glsl");
+    Shader& s = *waveShader;
 
     // setup texture uniforms
     s.use();
     s.setInt("texture1", 0);
     s.setInt("texture2", 1);
-    s.setInt("normals", 2);
     s.setInt("colorPalette", 3);
     s.setVec3("col1", glm::vec3(120,197,220));
     s.setVec3("col2", glm::vec3(183,236,234));
 
     // Transformation matrices for the plane
     glm::mat4 view = glm::mat4(1.0f);
-    glm::mat4 projection = glm::mat4(1.0f);
     glm::mat4 model = glm::mat4(1.0f);
-    projection = glm::perspective(glm::radians(45.0f), (float) WINDOW_WIDTH / (float) WINDOW_HEIGHT, 0.1f, 100.0f);
+    windowProjection = projectionMatrix(WINDOW_WIDTH, WINDOW_HEIGHT);
+    glm::mat4 projection = windowProjection;
     view = glm::translate(view, glm::vec3(0.0f, 5.0f, 5.0f));
 
     s.setMat4("model", model);
-    s.setMat4("view", view);
     s.setMat4("projection", projection);
 
     s.setVec2i("SIM_SIZE", SIMULATION_WIDTH, SIMULATION_HEIGHT);
     s.setVec3("lightColor", 242.0 / 255.0, 218.0 / 255.0, 200.0 / 255.0);
 
     printf("Created RenderProgram\n");
-    // create compute shader
-    ComputeShader computeS = ComputeShader("./src/shaders/compute/compute.glsl");
-    computeShader = &computeS;
-
-    // setup uniform variables
-    computeS.use();
-    computeS.setFloat("csqrd", 1.0);
-    computeS.setFloat("freq", FREQ);
-    computeS.setFloat("amplitude", AMPLITUDE);
-    computeS.setFloat("padding", PADDING);
-    computeS.setFloat("damping", DAMPING);
-    computeS.setVec2i("SIM_SIZE", SIMULATION_WIDTH, SIMULATION_HEIGHT);
 
-    printf("Created ComputeProgram\n");
+    glGenBuffers(1, &glObjects.frameUniforms);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, glObjects.frameUniforms);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
 
 
-    Shader l("./src/shaders/compute/light/light_cube.vs", "./src/shaders/compute/light/light_cube.fs");
-    lightShader = &l;
+    lightShader = new Shader("./src/shaders/compute/light/light_cube.vs", "./src/shaders/compute/light/light_cube.fs");
+    Shader& l = *lightShader;
 
     l.use();
     l.setMat4("model", model);
@@ -761,61 +1801,6 @@ int main() {
 
     printf("Created Light shader\n");
 
-    ComputeShader copyS = ComputeShader("./src/shaders/compute/copy.glsl");
-    copyShader = &copyS;
-
-    copyS.use();
-    copyS.setFloat("padding", PADDING);
-    printf("Created copy compute shader\n");
-
-    // Generate textures for use by compute shader
-    // Creates a texture which contains a border of 1 pixel.
-    // It is instrumental that the compute shader keeps this in mind as the padding
-    // serves as the boundary condition for the wave simulation.
-
-    int tex_w = SIMULATION_WIDTH + PADDING * 2, tex_h = SIMULATION_HEIGHT + PADDING * 2;
-    unsigned int tex_output[3];
-    glGenTextures(3, tex_output);
-
-
-    // Initialize some zero data for the textures.
-    float* data = (float *) malloc((tex_w * 4 * sizeof(float)) * (tex_h * 4 *sizeof(float)));
-    for (int i = 0; i< tex_w * 4; i++) {
-        for (int j = 0; j< tex_h * 4; j++) {
-            data[j + i * tex_w] = 0;
-            data[j + i * tex_w + 1] = 0.5;
-            data[j + i * tex_w + 2] = 0.5;
-            data[j + i * tex_w + 3] = 0.5;
-        }
-    }
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex_output[0]);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, tex_w, tex_h, 0, GL_RGBA, GL_FLOAT, (float *) data);
-    glBindImageTexture(0, tex_output[0], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
-
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, tex_output[1]);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, tex_w, tex_h, 0, GL_RGBA, GL_FLOAT, (float *) data);
-    glBindImageTexture(1, tex_output[1], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
-
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, tex_output[2]);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, tex_w, tex_h, 0, GL_RGBA, GL_FLOAT, (float *) data);
-    glBindImageTexture(2, tex_output[2], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
-
     //Create color pallette texture
     // load image
     int width, height, nrChannels;
@@ -830,6 +1815,8 @@ int main() {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, paletteData); 
     stbi_image_free(paletteData);
+    // Unit 3 keeps the palette, the heights are bound to units 0 and 1 before every draw.
+    glActiveTexture(GL_TEXTURE0);
 
 
 
@@ -848,12 +1835,44 @@ int main() {
     printf("max global (total) work group sizes: x:%i, y:%i, z:%i\n",
             work_grp_size[0], work_grp_size[1], work_grp_size[2]);
 
-    // Initialize data struct
-    glObjects.VAO = VAO;
-    glObjects.tex_w = tex_w;
-    glObjects.tex_h = tex_h;
-    glObjects.textures = tex_output;
 
+    if (VERIFY_CPU) {
+        verifyCpuSolver();
+        closeContext(window);
+        return 0;
+    }
+
+    if (COMPARE_PRECISION) {
+        comparePrecision();
+        closeContext(window);
+        return 0;
+    }
+
+    if (BENCH_TILES) {
+        benchmarkTileShapes();
+        closeContext(window);
+        return 0;
+    }
+
+    if (GPU_PROFILE || TRACE_FILE != NULL) {
+        // The trace takes the GPU passes from the profiler.
+        gpuProfiler = new GpuProfiler();
+    }
+
+    if (!createSolver()) {
+        delete gpuProfiler;
+        closeContext(window);
+        return -1;
+    }
+
+    if (OFFLINE_FRAMES > 0) {
+        bool ok = renderOffline();
+        if (TRACE_FILE != NULL) ok = Trace::write(TRACE_FILE) && ok;
+        delete solver;
+        delete gpuProfiler;
+        closeContext(window);
+        return ok ? 0 : -1;
+    }
 
     struct timespec start={0,0}, end={0,0};
     clock_gettime(CLOCK_MONOTONIC, &start);
@@ -864,11 +1883,16 @@ int main() {
     clock_gettime(CLOCK_MONOTONIC, &end);
     double diff_in_seconds = ((double)end.tv_sec + 1.0e-9 * end.tv_nsec) - ((double) start.tv_sec + 1.0e-9 * start.tv_nsec);
     printf("time elapsed in s: %lf\n", diff_in_seconds);
+    if (TRACE_FILE != NULL) Trace::write(TRACE_FILE);
 
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    bool ok = solver != NULL;
+    delete solver;
+    delete gpuProfiler;
+    glDeleteVertexArrays(1, &glObjects.VAO);
+    glDeleteBuffers(1, &glObjects.meshVertices);
+    glDeleteBuffers(1, &glObjects.meshIndices);
 
-    glfwTerminate();
+    closeContext(window);
 
-    return 0;
+    return ok ? 0 : -1;
 }
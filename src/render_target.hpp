@@ -0,0 +1,159 @@
+#ifndef RENDER_TARGET_H
+#define RENDER_TARGET_H
+
+#include <glad/glad.h>
+#include <stdio.h>
+#include <algorithm>
+
+/*
+ * Offscreen framebuffer with a colour and a depth renderbuffer. A multisampled
+ * target is resolved into a second, single sampled framebuffer before the
+ * colour is read back. A single sampled target keeps its colour in a texture
+ * instead, so shaders can read it.
+ */
+class RenderTarget
+{
+    int width, height, samples;
+    unsigned int fbo, color, depth;
+    unsigned int colorTexture; // 0 with multisampling, color is used instead
+    unsigned int resolveFbo, resolveColor; // 0 without multisampling
+
+    static unsigned int createRenderbuffer(int samples, GLenum format, int width, int height)
+    {
+        unsigned int rb;
+        glGenRenderbuffers(1, &rb);
+        glBindRenderbuffer(GL_RENDERBUFFER, rb);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, format, width, height);
+        return rb;
+    }
+public:
+    RenderTarget(int width, int height, int samples = 1)
+    {
+        int maxSamples;
+        glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+        this->width = width;
+        this->height = height;
+        this->samples = std::max(1, std::min(samples, maxSamples));
+
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        int s = this->samples > 1 ? this->samples : 0;
+        color = 0;
+        colorTexture = 0;
+        if (this->samples > 1)
+        {
+            color = createRenderbuffer(s, GL_RGBA8, width, height);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+        }
+        else
+        {
+            glGenTextures(1, &colorTexture);
+            glBindTexture(GL_TEXTURE_2D, colorTexture);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+        }
+        depth = createRenderbuffer(s, GL_DEPTH_COMPONENT32F, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+        resolveFbo = 0;
+        resolveColor = 0;
+        if (this->samples > 1)
+        {
+            glGenFramebuffers(1, &resolveFbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, resolveFbo);
+            resolveColor = createRenderbuffer(0, GL_RGBA8, width, height);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, resolveColor);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    ~RenderTarget()
+    {
+        glDeleteFramebuffers(1, &fbo);
+        if (color != 0) glDeleteRenderbuffers(1, &color);
+        if (colorTexture != 0) glDeleteTextures(1, &colorTexture);
+        glDeleteRenderbuffers(1, &depth);
+        if (resolveFbo != 0)
+        {
+            glDeleteFramebuffers(1, &resolveFbo);
+            glDeleteRenderbuffers(1, &resolveColor);
+        }
+    }
+    RenderTarget(const RenderTarget&) = delete;
+    RenderTarget& operator=(const RenderTarget&) = delete;
+
+    // Largest width and height a target may have on this driver.
+    static int maxSize()
+    {
+        int renderbufferSize, textureSize;
+        glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &renderbufferSize);
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &textureSize);
+        return std::min(renderbufferSize, textureSize);
+    }
+
+    bool isComplete()
+    {
+        unsigned int fbos[] = { fbo, resolveFbo };
+        for (int i = 0; i < 2; i++)
+        {
+            if (fbos[i] == 0) continue;
+            glBindFramebuffer(GL_FRAMEBUFFER, fbos[i]);
+            GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if (status != GL_FRAMEBUFFER_COMPLETE)
+            {
+                printf("ERROR::RENDER_TARGET::INCOMPLETE %dx%d, status 0x%x\n", width, height, status);
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                return false;
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return true;
+    }
+
+    // Directs rendering into the target and covers it with the viewport.
+    void bind()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, width, height);
+    }
+
+    // Binds the single sampled colour for reading, resolving it first if needed.
+    void bindForReading()
+    {
+        if (resolveFbo != 0)
+        {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFbo);
+            glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        }
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, resolveFbo != 0 ? resolveFbo : fbo);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+    }
+
+    // Reads the colour as tightly packed RGB rows, bottom row first.
+    void readPixels(unsigned char* rgb)
+    {
+        bindForReading();
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rgb);
+    }
+
+    int getWidth() const
+    {
+        return width;
+    }
+    int getHeight() const
+    {
+        return height;
+    }
+    int getSamples() const
+    {
+        return samples;
+    }
+    // Texture holding the colour of a single sampled target, 0 if multisampled.
+    unsigned int getColorTexture() const
+    {
+        return colorTexture;
+    }
+};
+#endif
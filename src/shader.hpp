@@ -9,66 +9,150 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
 
-class Shader
+// Locations of the active uniforms of a linked program. They are resolved once
+// after linking, so setting a uniform neither allocates nor queries the driver.
+class UniformLocations
+{
+    std::vector<std::pair<std::string, int> > locations; // sorted by name
+    mutable std::vector<std::string> reported;
+public:
+    void resolve(unsigned int program)
+    {
+        int count, maxLength;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> name(maxLength + 1);
+        locations.clear();
+        for (int i = 0; i < count; i++)
+        {
+            int size;
+            GLenum type;
+            glGetActiveUniform(program, i, (GLsizei) name.size(), NULL, &size, &type, name.data());
+            int location = glGetUniformLocation(program, name.data());
+            // Members of uniform blocks have no location.
+            if (location < 0) continue;
+            std::string n(name.data());
+            locations.push_back(std::make_pair(n, location));
+            // Arrays are reported as "name[0]", but set by their plain name.
+            if (n.size() > 3 && n.compare(n.size() - 3, 3, "[0]") == 0)
+                locations.push_back(std::make_pair(n.substr(0, n.size() - 3), location));
+        }
+        std::sort(locations.begin(), locations.end());
+    }
+    // Returns the location of the uniform or -1, which glUniform* ignores.
+    int find(const char* name) const
+    {
+        std::vector<std::pair<std::string, int> >::const_iterator it = std::lower_bound(locations.begin(), locations.end(), name,
+            [](const std::pair<std::string, int> &entry, const char* key) { return strcmp(entry.first.c_str(), key) < 0; });
+        if (it != locations.end() && it->first == name)
+            return it->second;
+        // Unknown or optimized out by the compiler, reported once per name.
+        if (std::find(reported.begin(), reported.end(), name) == reported.end())
+        {
+            reported.push_back(name);
+            std::cout << "WARNING::SHADER::UNKNOWN_UNIFORM: " << name << std::endl;
+        }
+        return -1;
+    }
+};
+
+/*
+ * A program built from any combination of shader stages.
+ * Linked programs are kept in an on-disk cache via glGetProgramBinary, keyed by
+ * a hash of the stage sources and the driver strings. A cached binary which the
+ * driver rejects, or whose key does not match, falls back to compiling.
+ */
+class ShaderProgram
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+
+    // Directory of the program binary cache, an empty string disables it.
+    static std::string& cacheDirectory()
+    {
+        static std::string directory = "./shader_cache";
+        return directory;
+    }
+
+    ShaderProgram()
+    {
+        ID = 0;
+    }
+    // The program is deleted with the object, so it has to go before the context.
+    ~ShaderProgram()
+    {
+        if (ID != 0)
+            glDeleteProgram(ID);
+    }
+    ShaderProgram(const ShaderProgram&) = delete;
+    ShaderProgram& operator=(const ShaderProgram&) = delete;
+    // Adds a stage read from path. defines is optional preprocessor text
+    // (e.g. "#define TILE_X 16\n") inserted directly after the #version line.
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    void addStage(GLenum type, const char* path, const std::string &defines = "")
     {
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
+        std::string code;
+        std::ifstream shaderFile;
         // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        shaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
         try 
         {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode   = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
+            shaderFile.open(path);
+            std::stringstream shaderStream;
+            shaderStream << shaderFile.rdbuf();
+            shaderFile.close();
+            code = shaderStream.str();
         }
         catch (std::ifstream::failure& e)
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path << std::endl;
+        }
+        if (!defines.empty())
+        {
+            size_t versionEnd = code.find('\n');
+            code.insert(versionEnd == std::string::npos ? code.size() : versionEnd + 1, defines);
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // shader Program
+        stages.push_back(std::make_pair(type, code));
+    }
+    // Links the added stages, from the cache if possible.
+    // ------------------------------------------------------------------------
+    void link()
+    {
+        std::string key = cacheKey();
         ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+        if (!loadBinary(key))
+        {
+            std::vector<unsigned int> shaders;
+            for (size_t i = 0; i < stages.size(); i++)
+            {
+                const char* code = stages[i].second.c_str();
+                unsigned int shader = glCreateShader(stages[i].first);
+                glShaderSource(shader, 1, &code, NULL);
+                glCompileShader(shader);
+                checkCompileErrors(shader, stageName(stages[i].first));
+                glAttachShader(ID, shader);
+                shaders.push_back(shader);
+            }
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            glLinkProgram(ID);
+            checkCompileErrors(ID, "PROGRAM");
+            // delete the shaders as they're linked into our program now and no longer necessary
+            for (size_t i = 0; i < shaders.size(); i++)
+            {
+                glDetachShader(ID, shaders[i]);
+                glDeleteShader(shaders[i]);
+            }
+            saveBinary(key);
+        }
+        stages.clear();
+        uniforms.resolve(ID);
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -78,227 +162,179 @@ public:
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(const char* name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        glUniform1i(uniforms.find(name), (int)value); 
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(const char* name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1i(uniforms.find(name), value); 
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(const char* name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1f(uniforms.find(name), value); 
     }
  // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(const char* name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform2fv(uniforms.find(name), 1, &value[0]); 
     }
-    void setVec2(const std::string &name, float x, float y) const
+    void setVec2(const char* name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(uniforms.find(name), x, y); 
     }
-    void setVec2i(const std::string &name, int x, int y) const 
+    void setVec2i(const char* name, int x, int y) const 
     {
-        glUniform2i(glGetUniformLocation(ID, name.c_str()), x, y);
+        glUniform2i(uniforms.find(name), x, y);
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(const char* name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform3fv(uniforms.find(name), 1, &value[0]); 
     }
-    void setVec3(const std::string &name, float x, float y, float z) const
+    void setVec3(const char* name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(uniforms.find(name), x, y, z); 
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(const char* name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform4fv(uniforms.find(name), 1, &value[0]); 
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w) const
+    void setVec4(const char* name, float x, float y, float z, float w) const
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(uniforms.find(name), x, y, z, w); 
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat2(const char* name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(uniforms.find(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat3(const char* name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(uniforms.find(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    void setMat4(const char* name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(uniforms.find(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setVec2iArray(const std::string &name, int count, int arr[][2] )
+    void setVec2iArray(const char* name, int count, int arr[][2] )
     {
-        glUniform2iv(glGetUniformLocation(ID, name.c_str()), count, &arr[0][0]);
+        glUniform2iv(uniforms.find(name), count, &arr[0][0]);
     }
 
 
 private:
-    // utility function for checking shader compilation/linking errors.
-    // ------------------------------------------------------------------------
-    void checkCompileErrors(unsigned int shader, std::string type)
+    UniformLocations uniforms;
+    std::vector<std::pair<GLenum, std::string> > stages; // only kept until link()
+
+    static const char* stageName(GLenum type)
     {
-        int success;
-        char infoLog[1024];
-        if (type != "PROGRAM")
+        switch (type)
         {
-            glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-            if (!success)
-            {
-                glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
-            }
-        }
-        else
-        {
-            glGetProgramiv(shader, GL_LINK_STATUS, &success);
-            if (!success)
-            {
-                glGetProgramInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
-            }
+            case GL_VERTEX_SHADER: return "VERTEX";
+            case GL_FRAGMENT_SHADER: return "FRAGMENT";
+            case GL_GEOMETRY_SHADER: return "GEOMETRY";
+            case GL_COMPUTE_SHADER: return "COMPUTE";
+            default: return "SHADER";
         }
     }
-};
-
-class ComputeShader
-{
-public:
-    unsigned int ID;
-    // constructor generates the shader on the fly
+    // Identifies the program: the driver, followed by every stage with its source.
     // ------------------------------------------------------------------------
-    ComputeShader(const char* computeShaderPath)
+    std::string cacheKey()
     {
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string computeCode;
-        std::ifstream shaderFile;
-        // ensure ifstream objects can throw exceptions:
-        shaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
+        std::string key;
+        const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        for (size_t i = 0; i < 3; i++)
         {
-            // open files
-            shaderFile.open(computeShaderPath);
-            std::stringstream cShaderStream;
-            // read file's buffer contents into streams
-            cShaderStream << shaderFile.rdbuf();
-            // close file handlers
-            shaderFile.close();
-            // convert stream into string
-            computeCode = cShaderStream.str();
+            const char* s = (const char*) glGetString(strings[i]);
+            key += s ? s : "";
+            key += '\n';
         }
-        catch (std::ifstream::failure& e)
+        for (size_t i = 0; i < stages.size(); i++)
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+            key += std::to_string(stages[i].first) + '\n' + stages[i].second;
         }
-        const char* cShaderCode = computeCode.c_str();
-        // 2. compile shaders
-        unsigned int compute;
-        // vertex shader
-        compute = glCreateShader(GL_COMPUTE_SHADER);
-        glShaderSource(compute, 1, &cShaderCode, NULL);
-        glCompileShader(compute);
-        checkCompileErrors(compute, "COMPUTE");
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, compute);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(compute);
+        return key;
     }
-    // activate the shader
-    // ------------------------------------------------------------------------
-    void use() 
-    { 
-        glUseProgram(ID); 
-    }
-    // utility uniform functions
-    // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
-    {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
-    }
-    // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
-    { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
-    }
-    // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
-    { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
-    }
- // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
-    { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
-    }
-    void setVec2(const std::string &name, float x, float y) const
-    { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
-    }
-    void setVec2i(const std::string &name, int x, int y) const 
+    std::string cachePath(const std::string &key)
     {
-        glUniform2i(glGetUniformLocation(ID, name.c_str()), x, y);
-    }
-    // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
-    { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
-    }
-    void setVec3(const std::string &name, float x, float y, float z) const
-    { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
-    }
-    // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
-    { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
-    }
-    void setVec4(const std::string &name, float x, float y, float z, float w) const
-    { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
-    }
-    // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
-    {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-    }
-    // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
-    {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-    }
-    // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
-    {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        // 64 bit FNV-1a
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < key.size(); i++)
+        {
+            hash ^= (unsigned char) key[i];
+            hash *= 1099511628211ULL;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long) hash);
+        return cacheDirectory() + name;
     }
+    // A cache file holds the format, the key length, the key and the binary.
+    // The stored key guards against hash collisions and driver updates.
     // ------------------------------------------------------------------------
-    void setFloatArray(const std::string &name, int count, float arr[]) 
+    bool loadBinary(const std::string &key)
     {
-        glUniform1fv(glGetUniformLocation(ID, name.c_str()), count, &arr[0]);
+        int formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (cacheDirectory().empty() || formats == 0) return false;
+        FILE* file = fopen(cachePath(key).c_str(), "rb");
+        if (file == NULL) return false;
+
+        bool loaded = false;
+        uint32_t header[3]; // format, key length, binary length
+        if (fread(header, sizeof(header), 1, file) == 1 && header[1] == key.size())
+        {
+            std::string storedKey(header[1], '\0');
+            std::vector<char> binary(header[2]);
+            if (fread(&storedKey[0], 1, header[1], file) == header[1] && storedKey == key
+                && fread(binary.data(), 1, header[2], file) == header[2])
+            {
+                glProgramBinary(ID, header[0], binary.data(), header[2]);
+                int success;
+                glGetProgramiv(ID, GL_LINK_STATUS, &success);
+                loaded = success;
+            }
+        }
+        fclose(file);
+        if (!loaded)
+        {
+            // The driver rejected the binary, start over with a fresh program.
+            glDeleteProgram(ID);
+            ID = glCreateProgram();
+        }
+        return loaded;
     }
-    // ------------------------------------------------------------------------
-    void setVec2iArray(const std::string &name, int count, int arr[][2] )
+    void saveBinary(const std::string &key)
     {
-        glUniform2iv(glGetUniformLocation(ID, name.c_str()), count, &arr[0][0]);
-    }
-
+        int success, length = 0, formats = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (cacheDirectory().empty() || !success || formats == 0) return;
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) return;
 
-private:
+        std::vector<char> binary(length);
+        GLenum format;
+        glGetProgramBinary(ID, length, NULL, &format, binary.data());
+        mkdir(cacheDirectory().c_str(), 0755);
+        FILE* file = fopen(cachePath(key).c_str(), "wb");
+        if (file == NULL)
+        {
+            std::cout << "WARNING::SHADER::CACHE_NOT_WRITABLE: " << cacheDirectory() << std::endl;
+            return;
+        }
+        uint32_t header[3] = { format, (uint32_t) key.size(), (uint32_t) length };
+        fwrite(header, sizeof(header), 1, file);
+        fwrite(key.data(), 1, key.size(), file);
+        fwrite(binary.data(), 1, length, file);
+        fclose(file);
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(unsigned int shader, std::string type)
@@ -325,4 +361,27 @@ private:
         }
     }
 };
+
+// Vertex + fragment program.
+class Shader : public ShaderProgram
+{
+public:
+    Shader(const char* vertexPath, const char* fragmentPath)
+    {
+        addStage(GL_VERTEX_SHADER, vertexPath);
+        addStage(GL_FRAGMENT_SHADER, fragmentPath);
+        link();
+    }
+};
+
+// Compute program. defines is inserted directly after the #version line.
+class ComputeShader : public ShaderProgram
+{
+public:
+    ComputeShader(const char* computeShaderPath, const std::string &defines = "")
+    {
+        addStage(GL_COMPUTE_SHADER, computeShaderPath, defines);
+        link();
+    }
+};
 #endif
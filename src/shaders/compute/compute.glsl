@@ -1,65 +1,50 @@
-#version 460
+#version 450
 
-#define MAX_SOURCES 10
+/*
+ * Advances the height field by one step. Sources are injected afterwards by
+ * source_inject.glsl, so this kernel only evaluates the stencil and damping.
+ */
+
+// Storage format of the height textures, r16f in half precision mode.
+// Arithmetic is always done in 32 bit.
+#ifndef HEIGHT_FORMAT
+#define HEIGHT_FORMAT r32f
+#endif
 
 layout (local_size_x=1, local_size_y=1) in;
-layout (rgba32f, binding = 0) uniform image2D h1;
-layout (rgba32f, binding = 1) uniform image2D h2;
-layout (rgba32f, binding = 2) uniform image2D normals;
+layout (HEIGHT_FORMAT, binding = 0) uniform image2D h_cur;
+layout (HEIGHT_FORMAT, binding = 1) uniform image2D h_prev;
+
+// Written by the solver whenever they change (SolverUniforms in gpu_solver.cpp).
+layout (std140, binding = 1) uniform Solver {
+    float delta;
+    float damping;
+};
 
-uniform float delta;
 uniform float csqrd;
-uniform float time;
-uniform float freq;
-uniform float amplitude;
 uniform float padding;
-uniform float damping;
-
-uniform ivec2 sources[MAX_SOURCES];
-uniform float source_phases[MAX_SOURCES];
-uniform float source_amplitude[MAX_SOURCES];
-uniform float source_freq[MAX_SOURCES];
-
-uniform ivec2 SIM_SIZE;
 
 void main() {
     ivec2 pixel_coords = ivec2(gl_GlobalInvocationID.xy) + ivec2(padding, padding);
-    vec2 uv = vec2(float(pixel_coords.x) / gl_NumWorkGroups.x, float(pixel_coords.y) / gl_NumWorkGroups.y);
 
     // Get convolutional values
-    vec4 h = imageLoad(h1, pixel_coords);
-    vec4 h_yp = imageLoad(h1, pixel_coords + ivec2(0,1));
-    vec4 h_yn = imageLoad(h1, pixel_coords + ivec2(0,-1));
-    vec4 h_xp = imageLoad(h1, pixel_coords + ivec2(1,0));
-    vec4 h_xn = imageLoad(h1, pixel_coords + ivec2(-1,0));
+    float h = imageLoad(h_cur, pixel_coords).r;
+    float h_yp = imageLoad(h_cur, pixel_coords + ivec2(0,1)).r;
+    float h_yn = imageLoad(h_cur, pixel_coords + ivec2(0,-1)).r;
+    float h_xp = imageLoad(h_cur, pixel_coords + ivec2(1,0)).r;
+    float h_xn = imageLoad(h_cur, pixel_coords + ivec2(-1,0)).r;
 
     // Apply discretization of 2D wave equation.
-    float diff_x = h_xp.r - 2 * h.r + h_xn.r;
-    float diff_y = h_yp.r - 2 * h.r + h_yn.r;
+    float diff_x = h_xp - 2 * h + h_xn;
+    float diff_y = h_yp - 2 * h + h_yn;
     float delta_sqrd = delta;
     float diff_sum = csqrd * delta_sqrd * (diff_x + diff_y);
-    float h_new = 2 * h.r - h.g + diff_sum;
-
-    // Apply Source Wave
-    bool source = false;
-    float source_phase = 0;
-    float source_amp;
-    float source_fq;
-    for (int i = 0; i < MAX_SOURCES; i++) {
-        bool source_is_active = (pixel_coords.x == sources[i].x + padding && pixel_coords.y == sources[i].y + padding);
-        source  = source || source_is_active;
-        if (source_is_active) {
-            source_phase = source_phases[i];
-            source_amp = source_amplitude[i];
-            source_fq = source_freq[i];
-        }
-    }
-
-    h_new = h_new + csqrd * delta * int(source) * sin(source_phase * source_fq) * source_amp;
+    float h_new = 2 * h - imageLoad(h_prev, pixel_coords).r + diff_sum;
 
     // Damping
-    h_new -= damping * delta * (h_new - h.r);
+    h_new -= damping * delta * (h_new - h);
 
-    // output result in texture 2
-    imageStore(h2, pixel_coords, vec4(h_new, h.r, h.g, 1.0));
+    // The previous height is only read by this invocation, so the new height
+    // replaces it in place. The application then swaps h_cur and h_prev.
+    imageStore(h_prev, pixel_coords, vec4(h_new));
 }
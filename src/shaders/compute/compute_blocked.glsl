@@ -0,0 +1,177 @@
+#version 450
+
+/*
+ * Temporally blocked variant of compute.glsl.
+ * Every workgroup loads its TILE_X x TILE_Y tile plus a halo of TIME_BLOCK
+ * cells of both the current and previous height into shared memory and
+ * advances TIME_BLOCK timesteps there. After every substep the region of
+ * valid cells shrinks by one cell on each side, so after the last substep
+ * exactly the tile is valid and gets written to out_cur and out_prev.
+ * Unlike the single step kernels this cannot update in place, as the halo
+ * is read from the tiles of neighbouring workgroups.
+ * This replaces TIME_BLOCK round trips to memory by one.
+ * Sources are read from the same source table as source_inject.glsl, but
+ * only those inside the region are gathered into a per-tile list first.
+ * The source state has to be advanced to the first substep before the
+ * dispatch, later substeps extrapolate the phase and keep the amplitude.
+ * TILE_X, TILE_Y and TIME_BLOCK are injected by the application at compile time.
+ */
+
+#ifndef TILE_X
+#define TILE_X 16
+#endif
+#ifndef TILE_Y
+#define TILE_Y 16
+#endif
+#ifndef TIME_BLOCK
+#define TIME_BLOCK 4
+#endif
+
+// Storage format of the height textures, r16f in half precision mode.
+#ifndef HEIGHT_FORMAT
+#define HEIGHT_FORMAT r32f
+#endif
+
+#define REGION_X (TILE_X + 2 * TIME_BLOCK)
+#define REGION_Y (TILE_Y + 2 * TIME_BLOCK)
+
+// Size of the source list of a region. A region holding more sources scans the
+// whole table instead, which is slow but exact. Set by GpuSolver, whose shared
+// memory check counts the list.
+#ifndef MAX_TILE_SOURCES
+#define MAX_TILE_SOURCES 256
+#endif
+
+layout (local_size_x=TILE_X, local_size_y=TILE_Y) in;
+layout (HEIGHT_FORMAT, binding = 0) uniform readonly image2D h_cur;
+layout (HEIGHT_FORMAT, binding = 1) uniform readonly image2D h_prev;
+layout (HEIGHT_FORMAT, binding = 2) uniform writeonly image2D out_cur;
+layout (HEIGHT_FORMAT, binding = 3) uniform writeonly image2D out_prev;
+
+// Written by the solver whenever they change (SolverUniforms in gpu_solver.cpp).
+layout (std140, binding = 1) uniform Solver {
+    float delta;
+    float damping;
+};
+
+uniform float csqrd;
+uniform float padding;
+
+uniform ivec2 SIM_SIZE;
+
+struct SourceParams {
+    ivec2 pos;
+    float freq;
+    float amplitude;
+    float phase;
+    uint epoch;
+};
+
+struct SourceState {
+    float phase; // phase of the first substep, later substeps advance it by delta
+    float amplitude;
+    uint epoch;
+    float unused;
+};
+
+layout (std430, binding = 0) readonly buffer Params {
+    SourceParams params[];
+};
+layout (std430, binding = 1) readonly buffer States {
+    SourceState states[];
+};
+uniform int sourceCount;
+
+// Indices of the sources inside the region of this workgroup.
+shared int tileSources[MAX_TILE_SOURCES];
+shared int tileSourceCount;
+
+// Two time levels. A substep writes the new height over the previous one,
+// which is only ever read by the cell itself.
+shared float heights[2][REGION_Y][REGION_X];
+
+bool insideSimulation(ivec2 pixel_coords) {
+    ivec2 p = pixel_coords - ivec2(padding, padding);
+    return all(greaterThanEqual(p, ivec2(0))) && all(lessThan(p, SIM_SIZE));
+}
+
+void main() {
+    // Texel coordinate of the top left corner of the region.
+    ivec2 origin = ivec2(gl_WorkGroupID.xy) * ivec2(TILE_X, TILE_Y) + ivec2(padding, padding) - ivec2(TIME_BLOCK);
+
+    if (gl_LocalInvocationIndex == 0) {
+        tileSourceCount = 0;
+    }
+    barrier();
+    // Gather the sources which fall inside the region. Removed sources are
+    // parked outside of the simulation and skipped like in source_inject.glsl.
+    for (int i = int(gl_LocalInvocationIndex); i < sourceCount; i += TILE_X * TILE_Y) {
+        ivec2 pos = params[i].pos;
+        ivec2 t = pos + ivec2(padding, padding) - origin;
+        if (all(greaterThanEqual(pos, ivec2(0))) && all(lessThan(pos, SIM_SIZE))
+                && all(greaterThanEqual(t, ivec2(0))) && all(lessThan(t, ivec2(REGION_X, REGION_Y)))) {
+            int slot = atomicAdd(tileSourceCount, 1);
+            if (slot < MAX_TILE_SOURCES) {
+                tileSources[slot] = i;
+            }
+        }
+    }
+
+    // Load the region. Cells outside of the simulation are the zero boundary.
+    for (uint i = gl_LocalInvocationIndex; i < REGION_X * REGION_Y; i += TILE_X * TILE_Y) {
+        ivec2 t = ivec2(i % REGION_X, i / REGION_X);
+        bool inside = insideSimulation(origin + t);
+        heights[0][t.y][t.x] = inside ? imageLoad(h_cur, origin + t).r : 0.0;
+        heights[1][t.y][t.x] = inside ? imageLoad(h_prev, origin + t).r : 0.0;
+    }
+    barrier();
+
+    bool overflow = tileSourceCount > MAX_TILE_SOURCES;
+    int regionSources = overflow ? sourceCount : tileSourceCount;
+
+    int cur = 0;
+    for (int k = 1; k <= TIME_BLOCK; k++) {
+        int prev = 1 - cur;
+        for (uint i = gl_LocalInvocationIndex; i < REGION_X * REGION_Y; i += TILE_X * TILE_Y) {
+            ivec2 t = ivec2(i % REGION_X, i / REGION_X);
+            ivec2 pixel_coords = origin + t;
+            // Only cells whose neighbours were valid in the last substep are updated.
+            if (any(lessThan(t, ivec2(k))) || any(greaterThanEqual(t, ivec2(REGION_X - k, REGION_Y - k))) || !insideSimulation(pixel_coords)) {
+                continue;
+            }
+
+            // Apply discretization of 2D wave equation.
+            float h = heights[cur][t.y][t.x];
+            float diff_x = heights[cur][t.y][t.x + 1] - 2 * h + heights[cur][t.y][t.x - 1];
+            float diff_y = heights[cur][t.y + 1][t.x] - 2 * h + heights[cur][t.y - 1][t.x];
+            float delta_sqrd = delta;
+            float diff_sum = csqrd * delta_sqrd * (diff_x + diff_y);
+            float h_new = 2 * h - heights[prev][t.y][t.x] + diff_sum;
+
+            // Damping
+            h_new -= damping * delta * (h_new - h);
+
+            // Apply Source Wave, scaled like in source_inject.glsl.
+            for (int s = 0; s < regionSources; s++) {
+                int index = overflow ? s : tileSources[s];
+                SourceParams src = params[index];
+                if (pixel_coords == src.pos + ivec2(padding, padding)) {
+                    SourceState state = states[index];
+                    float source_phase = state.phase + (k - 1) * delta;
+                    h_new += csqrd * delta * sin(source_phase * src.freq) * state.amplitude * (1.0 - damping * delta);
+                }
+            }
+
+            heights[prev][t.y][t.x] = h_new;
+        }
+        barrier();
+        cur = prev;
+    }
+
+    if (any(greaterThanEqual(gl_GlobalInvocationID.xy, uvec2(SIM_SIZE)))) {
+        return;
+    }
+    ivec2 t = ivec2(gl_LocalInvocationID.xy) + ivec2(TIME_BLOCK);
+    imageStore(out_cur, origin + t, vec4(heights[cur][t.y][t.x]));
+    imageStore(out_prev, origin + t, vec4(heights[1 - cur][t.y][t.x]));
+}
@@ -0,0 +1,79 @@
+#version 450
+
+/*
+ * Tiled variant of compute.glsl.
+ * Every workgroup loads a TILE_X x TILE_Y tile of h_cur plus a one cell halo
+ * into shared memory once, after which the 5-point stencil is evaluated
+ * from shared memory instead of issuing five imageLoads per cell.
+ * Like compute.glsl it leaves the sources to source_inject.glsl.
+ * TILE_X and TILE_Y are injected by the application at compile time.
+ */
+
+#ifndef TILE_X
+#define TILE_X 16
+#endif
+#ifndef TILE_Y
+#define TILE_Y 16
+#endif
+
+// Storage format of the height textures, r16f in half precision mode.
+#ifndef HEIGHT_FORMAT
+#define HEIGHT_FORMAT r32f
+#endif
+
+#define HALO_X (TILE_X + 2)
+#define HALO_Y (TILE_Y + 2)
+
+layout (local_size_x=TILE_X, local_size_y=TILE_Y) in;
+layout (HEIGHT_FORMAT, binding = 0) uniform image2D h_cur;
+layout (HEIGHT_FORMAT, binding = 1) uniform image2D h_prev;
+
+// Written by the solver whenever they change (SolverUniforms in gpu_solver.cpp).
+layout (std140, binding = 1) uniform Solver {
+    float delta;
+    float damping;
+};
+
+uniform float csqrd;
+uniform float padding;
+
+uniform ivec2 SIM_SIZE;
+
+shared float tile[HALO_Y][HALO_X];
+
+void main() {
+    // Texel coordinate of the top left corner of the halo.
+    ivec2 origin = ivec2(gl_WorkGroupID.xy) * ivec2(TILE_X, TILE_Y) + ivec2(padding, padding) - ivec2(1, 1);
+
+    // Cooperatively load tile + halo. Loads outside of the texture return 0,
+    // which matches the zero boundary held by the padding.
+    for (uint i = gl_LocalInvocationIndex; i < HALO_X * HALO_Y; i += TILE_X * TILE_Y) {
+        ivec2 t = ivec2(i % HALO_X, i / HALO_X);
+        tile[t.y][t.x] = imageLoad(h_cur, origin + t).r;
+    }
+    barrier();
+
+    // Invocations outside of the simulation only help loading the halo.
+    if (any(greaterThanEqual(gl_GlobalInvocationID.xy, uvec2(SIM_SIZE)))) {
+        return;
+    }
+
+    ivec2 pixel_coords = ivec2(gl_GlobalInvocationID.xy) + ivec2(padding, padding);
+    ivec2 l = ivec2(gl_LocalInvocationID.xy) + ivec2(1, 1);
+
+    float h_c = tile[l.y][l.x];
+
+    // Apply discretization of 2D wave equation.
+    float diff_x = tile[l.y][l.x + 1] - 2 * h_c + tile[l.y][l.x - 1];
+    float diff_y = tile[l.y + 1][l.x] - 2 * h_c + tile[l.y - 1][l.x];
+    float delta_sqrd = delta;
+    float diff_sum = csqrd * delta_sqrd * (diff_x + diff_y);
+    // The previous height is only needed for the cell itself.
+    float h_new = 2 * h_c - imageLoad(h_prev, pixel_coords).r + diff_sum;
+
+    // Damping
+    h_new -= damping * delta * (h_new - h_c);
+
+    // The new height replaces the previous one in place.
+    imageStore(h_prev, pixel_coords, vec4(h_new));
+}
@@ -0,0 +1,36 @@
+#version 450
+
+/*
+ * Box filters a supersampled image down by an integer factor, one invocation
+ * per output pixel. The colours are averaged in linear light, so edges keep
+ * the brightness a display shows, and encoded as sRGB again.
+ */
+
+layout (local_size_x=8, local_size_y=8) in;
+layout (rgba8, binding = 0) uniform readonly image2D source;
+layout (rgba8, binding = 1) uniform writeonly image2D result;
+
+uniform int factor;
+uniform ivec2 size; // of the result
+
+vec3 toLinear(vec3 c) {
+    return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), greaterThan(c, vec3(0.04045)));
+}
+
+vec3 toSrgb(vec3 c) {
+    return mix(c * 12.92, 1.055 * pow(c, vec3(1.0 / 2.4)) - 0.055, greaterThan(c, vec3(0.0031308)));
+}
+
+void main() {
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(p, size))) {
+        return;
+    }
+    vec3 sum = vec3(0.0);
+    for (int y = 0; y < factor; y++) {
+        for (int x = 0; x < factor; x++) {
+            sum += toLinear(imageLoad(source, p * factor + ivec2(x, y)).rgb);
+        }
+    }
+    imageStore(result, p, vec4(toSrgb(sum / float(factor * factor)), 1.0));
+}
@@ -1,23 +1,29 @@
-#version 460 core
+#version 450 core
 
 in vec2 TexCoord;
 in vec3 FragPos;
 
 out vec4 FragColor;
 
-uniform float time;
+// Per-frame data, written once per frame by the application (FrameUniforms in main.cpp).
+layout (std140, binding = 0) uniform Frame {
+    mat4 view;
+    vec4 lightPos;
+    float time;
+    float alpha; // interpolation factor between the previous and the latest height
+};
+
 // Lighting
 uniform vec3 lightColor;
-uniform vec3 lightPos;
 // Colors
 uniform vec3 col1;
 uniform vec3 col2;
 
 uniform ivec2 SIM_SIZE;
 
+// Previous and latest heights.
 uniform sampler2D texture1;
 uniform sampler2D texture2;
-uniform sampler2D normals;
 uniform sampler2D colorPalette;
 
 const float ambientStrength = 0.2;
@@ -36,26 +42,30 @@ vec3 rgb2normalized(vec3 c) {
     return vec3(c.r / 255.0, c.g / 255.0, c.b / 255.0);
 }
 
+float height(vec2 uv) {
+    return mix(texture(texture1, uv).r, texture(texture2, uv).r, alpha);
+}
+
 vec3 calcNormal() {
     // central difference approximation of gradient
     float EPSILON_X = 1.0 / SIM_SIZE[0];
     float EPSILON_Y = 1.0 / SIM_SIZE[1];
-    float hxp = texture(texture2, vec2(TexCoord.x + EPSILON_X, TexCoord.y)).r;
-    float hxn = texture(texture2, vec2(TexCoord.x - EPSILON_X, TexCoord.y)).r;
-    float hyp = texture(texture2, vec2(TexCoord.x, TexCoord.y + EPSILON_Y)).r;
-    float hyn = texture(texture2, vec2(TexCoord.x, TexCoord.y - EPSILON_Y)).r;
+    float hxp = height(vec2(TexCoord.x + EPSILON_X, TexCoord.y));
+    float hxn = height(vec2(TexCoord.x - EPSILON_X, TexCoord.y));
+    float hyp = height(vec2(TexCoord.x, TexCoord.y + EPSILON_Y));
+    float hyn = height(vec2(TexCoord.x, TexCoord.y - EPSILON_Y));
     return normalize(vec3((hxn - hxp) / (EPSILON_X * 2), 1,- (hyn - hyp) / (EPSILON_Y * 2)));
 }
 
 void main(){
-    vec4 h = texture(texture2, TexCoord);
-    vec3 col = mix(rgb2normalized(col1)*1.2,rgb2normalized(col2)*1.2,h.r*2.5);
+    float h = height(TexCoord);
+    vec3 col = mix(rgb2normalized(col1)*1.2,rgb2normalized(col2)*1.2,h*2.5);
 
     // lighting
     vec3 n = calcNormal();
     n = mix(n, vec3(0,1,0), 0.3);
     vec3 ambient = ambientStrength * lightColor;
-    vec3 lightDir = normalize(lightPos - FragPos);
+    vec3 lightDir = normalize(lightPos.xyz - FragPos);
     float diff = max(dot(n, lightDir), 0.0);
     vec3 diffuse = diff * lightColor;
     vec3 finalCol = col * (ambient + diffuse); 
@@ -0,0 +1,75 @@
+#version 450
+
+/*
+ * Converts a frame read back with glReadPixels (RGBA, bottom row first) into
+ * the byte layout a video stream wants, top row first:
+ * packed RGB24, or with YUV420 defined planar I420 (full resolution Y, then
+ * U and V subsampled 2x2 by averaging, so the chroma sits between the pixels
+ * like JPEG) in BT.601 limited range.
+ * Runs one invocation per four output bytes, which are packed into one uint.
+ */
+
+layout (local_size_x=64) in;
+
+layout (std430, binding = 2) readonly buffer Pixels {
+    uint rgba[];
+};
+layout (std430, binding = 3) writeonly buffer Frame {
+    uint bytes[];
+};
+
+uniform ivec2 size;
+
+vec3 pixel(int x, int y) {
+    // y counts from the top.
+    return unpackUnorm4x8(rgba[(size.y - 1 - y) * size.x + x]).rgb;
+}
+
+#ifdef YUV420
+uint frameByte(int i) {
+    int lumaSize = size.x * size.y;
+    if (i < lumaSize) {
+        vec3 c = pixel(i % size.x, i / size.x);
+        return uint(round(16.0 + 219.0 * dot(c, vec3(0.299, 0.587, 0.114))));
+    }
+    ivec2 chromaSize = (size + 1) / 2;
+    i -= lumaSize;
+    int plane = i / (chromaSize.x * chromaSize.y); // 0 for U, 1 for V
+    i %= chromaSize.x * chromaSize.y;
+    ivec2 p0 = 2 * ivec2(i % chromaSize.x, i / chromaSize.x);
+    ivec2 p1 = min(p0 + 1, size - 1);
+    vec3 c = 0.25 * (pixel(p0.x, p0.y) + pixel(p1.x, p0.y) + pixel(p0.x, p1.y) + pixel(p1.x, p1.y));
+    vec3 weights = plane == 0 ? vec3(-0.168736, -0.331264, 0.5) : vec3(0.5, -0.418688, -0.081312);
+    return uint(round(128.0 + 224.0 * dot(c, weights)));
+}
+
+int frameSize() {
+    ivec2 chromaSize = (size + 1) / 2;
+    return size.x * size.y + 2 * chromaSize.x * chromaSize.y;
+}
+#else
+uint frameByte(int i) {
+    int p = i / 3;
+    return uint(round(255.0 * pixel(p % size.x, p / size.x)[i % 3]));
+}
+
+int frameSize() {
+    return 3 * size.x * size.y;
+}
+#endif
+
+void main() {
+    int word = int(gl_GlobalInvocationID.x);
+    int total = frameSize();
+    if (4 * word >= total) {
+        return;
+    }
+    uint value = 0u;
+    for (int b = 0; b < 4; b++) {
+        int i = 4 * word + b;
+        if (i < total) {
+            value |= min(frameByte(i), 255u) << (8 * b);
+        }
+    }
+    bytes[word] = value;
+}
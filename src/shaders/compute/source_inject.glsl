@@ -0,0 +1,129 @@
+#version 450
+
+/*
+ * Advances the GPU resident source table and injects the sources into the
+ * latest heights. Runs one invocation per source.
+ * The parameters (position, frequency, target amplitude) are written by the
+ * CPU only when a source changes, the phase and the amplitude ramp live in
+ * the state buffer and are only touched here.
+ * For injection this needs to be called after the stencil pass (compute.glsl
+ * or compute_tiled.glsl) with a memory barrier in between. The solver kernels
+ * apply damping to the stencil result, so the source term is scaled by the
+ * same factor to match adding it before the damping.
+ * With inject unset the sources are only advanced, which the temporally
+ * blocked kernel relies on as it injects the sources itself.
+ * Several sources may share a cell, so injecting takes two dispatches: the
+ * first adds every source term in fixed point to sums with an atomic add,
+ * the second (fold set, after an image barrier) moves each sum into the
+ * heights. Integer addition does not depend on the order, which keeps the
+ * result deterministic, and the first invocation of a cell to exchange the
+ * sum for zero takes all of it.
+ * The fixed point has two limits. Source terms are rounded to multiples of
+ * 2^-20 (1 / SUM_SCALE), so the heights are not bit identical to the CPU
+ * solver, which adds the terms in float. The sum of one cell saturates at
+ * +-2048 per step instead of wrapping around; once it saturates the result
+ * depends on the order of the additions again.
+ */
+
+#ifndef HEIGHT_FORMAT
+#define HEIGHT_FORMAT r32f
+#endif
+
+layout (local_size_x=64) in;
+layout (HEIGHT_FORMAT, binding = 0) uniform image2D h_cur;
+layout (r32i, binding = 4) uniform iimage2D sourceSum; // zero between the dispatches
+
+// Fixed point scale of sourceSum, a source term is at most csqrd * delta * amplitude.
+#define SUM_SCALE 1048576.0
+#define SUM_MAX 2147483647
+
+struct SourceParams {
+    ivec2 pos;
+    float freq;
+    float amplitude; // amplitude the source approaches
+    float phase;     // phase to restart at when epoch changes
+    uint epoch;
+};
+
+struct SourceState {
+    float phase;
+    float amplitude;
+    uint epoch;
+    float unused;
+};
+
+layout (std430, binding = 0) readonly buffer Params {
+    SourceParams params[];
+};
+layout (std430, binding = 1) buffer States {
+    SourceState states[];
+};
+
+// Written by the solver whenever they change (SolverUniforms in gpu_solver.cpp).
+layout (std140, binding = 1) uniform Solver {
+    float delta;
+    float damping;
+};
+
+uniform int sourceCount;
+uniform int steps;    // number of steps to advance the sources by
+uniform bool inject;
+uniform bool fold;    // second injection dispatch, the sources are not advanced
+uniform float ampResponseRate;
+uniform float csqrd;
+uniform float padding;
+
+uniform ivec2 SIM_SIZE;
+
+void main() {
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= sourceCount) {
+        return;
+    }
+    SourceParams p = params[i];
+    SourceState s = states[i];
+
+    // Removed sources are parked outside of the simulation.
+    bool inside = all(greaterThanEqual(p.pos, ivec2(0))) && all(lessThan(p.pos, SIM_SIZE));
+    ivec2 pixel_coords = p.pos + ivec2(padding, padding);
+
+    if (fold) {
+        int sum = inside ? imageAtomicExchange(sourceSum, pixel_coords, 0) : 0;
+        if (sum != 0) {
+            float h = imageLoad(h_cur, pixel_coords).r;
+            imageStore(h_cur, pixel_coords, vec4(h + float(sum) / SUM_SCALE));
+        }
+        return;
+    }
+
+    if (s.epoch != p.epoch) {
+        s.phase = p.phase;
+        s.epoch = p.epoch;
+    }
+    // Every step the amplitude closes the gap to the target by ampResponseRate * delta.
+    s.phase += steps * delta;
+    s.amplitude = p.amplitude + (s.amplitude - p.amplitude) * pow(max(1.0 - ampResponseRate * delta, 0.0), float(steps));
+    states[i] = s;
+
+    if (!inject || !inside) {
+        return;
+    }
+    float term = csqrd * delta * sin(s.phase * p.freq) * s.amplitude * (1.0 - damping * delta);
+    // A single term beyond the range of the sum is clamped first.
+    int value = int(round(clamp(term, -2047.0, 2047.0) * SUM_SCALE));
+    if (value == 0) {
+        return;
+    }
+
+    // Saturating atomic add: retries until no other source changed the sum in between.
+    int sum = imageAtomicCompSwap(sourceSum, pixel_coords, 0, value);
+    while (sum != 0) {
+        int next = value > 0 ? (sum > SUM_MAX - value ? SUM_MAX : sum + value)
+                             : (sum < -SUM_MAX - value ? -SUM_MAX : sum + value);
+        int seen = imageAtomicCompSwap(sourceSum, pixel_coords, sum, next);
+        if (seen == sum) {
+            break;
+        }
+        sum = seen;
+    }
+}
@@ -1,4 +1,4 @@
-#version 460 core
+#version 450 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
 
@@ -6,15 +6,23 @@ out vec2 TexCoord;
 out vec3 FragPos;
 
 uniform mat4 model;
-uniform mat4 view;
 uniform mat4 projection;
 
+// Per-frame data, written once per frame by the application (FrameUniforms in main.cpp).
+layout (std140, binding = 0) uniform Frame {
+    mat4 view;
+    vec4 lightPos;
+    float time;
+    float alpha; // interpolation factor between the previous and the latest height
+};
+
+// Previous and latest heights.
+uniform sampler2D texture1;
 uniform sampler2D texture2;
 uniform ivec2 SIM_SIZE;
 
 void main() {
-    vec4 h = textureLod(texture2, aTexCoord, 0);
-    float yOffset = h.r;
+    float yOffset = mix(textureLod(texture1, aTexCoord, 0).r, textureLod(texture2, aTexCoord, 0).r, alpha);
     vec4 pos = vec4(aPos.x, aPos.y + yOffset, aPos.z, 1.0);
 
     gl_Position = projection * view * model * pos;
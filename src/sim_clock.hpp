@@ -0,0 +1,45 @@
+#ifndef SIM_CLOCK_H
+#define SIM_CLOCK_H
+
+/*
+ * Fixed timestep simulation clock.
+ * Elapsed wall clock time is accumulated and converted into a whole number of
+ * solver steps, so the simulation advances at the same rate regardless of the
+ * render rate. The remainder is used to interpolate between the last two states.
+ */
+class SimulationClock {
+    double stepPeriod;  // wall clock seconds per solver step
+    double accumulator; // wall clock seconds which have not been simulated yet
+    int maxSteps;       // upper bound on the steps taken for a single frame
+    long droppedSteps;
+    public:
+        SimulationClock(double stepPeriod, int maxSteps) {
+            this->stepPeriod = stepPeriod;
+            this->maxSteps = maxSteps;
+            accumulator = 0.0;
+            droppedSteps = 0;
+        }
+
+        // Adds elapsed wall clock time and returns the number of steps to take.
+        int advance(double elapsed) {
+            accumulator += elapsed;
+            int n = (int) (accumulator / stepPeriod);
+            if (n > maxSteps) {
+                // Drop the backlog instead of spiralling into ever longer frames.
+                droppedSteps += n - maxSteps;
+                accumulator -= (n - maxSteps) * stepPeriod;
+                n = maxSteps;
+            }
+            accumulator -= n * stepPeriod;
+            return n;
+        }
+
+        // Fraction of a step elapsed since the last step, in [0, 1).
+        float alpha() {
+            return (float) (accumulator / stepPeriod);
+        }
+        long getDroppedSteps() {
+            return droppedSteps;
+        }
+};
+#endif
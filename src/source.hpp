@@ -1,68 +1,128 @@
 #include <algorithm>
+#include <vector>
 
 #ifndef SOURCE_H
 #define SOURCE_H
 #define SOURCE_AMP_RESPONSE_RATE 2.0 // Determines the speed at which the amplitude can change
 
 struct SourcePos {
-    int x, y;   
+    int x, y;
 };
 
-class Source {
+// Layout of a source in the parameter storage buffer (std430). Only ever written by the CPU.
+// Incrementing epoch restarts the source at the given phase.
+struct SourceParams {
     int x, y;
-    float freq, amplitude, phase, cur_amplitude;
-    bool active;
+    float freq;
+    float amplitude; // amplitude the source approaches
+    float phase;
+    unsigned int epoch;
+};
+
+// Layout of a source in the state storage buffer (std430). Advanced on the GPU every step.
+struct SourceState {
+    float phase;
+    float amplitude;
+    unsigned int epoch;
+    float unused;
+};
+
+/*
+ * CPU side copy of the source parameters. Changes are only marked dirty here,
+ * the owner of the GPU buffers uploads the changed ranges with flush().
+ */
+class SourceTable {
+    std::vector<SourceParams> params;
+    std::vector<bool> dirty;
+    bool anyDirty;
     public:
-        Source(int x, int y, float amplitude, float freq) {
-            this->x = x;
-            this->y = y;
-            this->amplitude = amplitude;
-            this->freq = freq;
-            this->phase = 0;
-            active = true;
+        SourceTable() {
+            anyDirty = false;
         }
 
-        void update(double delta) {
-            phase+=delta;
-            // approach desired amplitude
-            float dAmp = amplitude - cur_amplitude; 
-            cur_amplitude += dAmp * SOURCE_AMP_RESPONSE_RATE * delta;
+        int add(int x, int y, float amplitude, float freq) {
+            params.push_back(SourceParams {x, y, freq, amplitude, 0.0f, 0});
+            dirty.push_back(true);
+            anyDirty = true;
+            return (int) params.size() - 1;
+        }
+
+        int size() const {
+            return (int) params.size();
+        }
+        const SourceParams& get(int i) const {
+            return params[i];
+        }
+        // Returns the parameters of source i for modification.
+        SourceParams& edit(int i) {
+            dirty[i] = true;
+            anyDirty = true;
+            return params[i];
+        }
+        void markAllDirty() {
+            std::fill(dirty.begin(), dirty.end(), true);
+            anyDirty = !params.empty();
         }
-        
+
+        // Calls upload(first, count, data) for every run of consecutive changed sources.
+        template <class F>
+        void flush(F upload) {
+            if (!anyDirty) {
+                return;
+            }
+            int n = size();
+            for (int i = 0; i < n; i++) {
+                if (!dirty[i]) continue;
+                int first = i;
+                while (i < n && dirty[i]) {
+                    dirty[i] = false;
+                    i++;
+                }
+                upload(first, i - first, &params[first]);
+            }
+            anyDirty = false;
+        }
+};
+
+// Handle to a source in a SourceTable.
+class Source {
+    SourceTable* table;
+    int index;
+    public:
+        Source(SourceTable* table, int x, int y, float amplitude, float freq) {
+            this->table = table;
+            index = table->add(x, y, amplitude, freq);
+        }
+
         void setInactive() {
-            active = false;
-            this->amplitude = 0.0;
+            table->edit(index).amplitude = 0.0;
         }
 
         void setActive() {
-            active = true;
-            this->phase = 0.0;
+            setPhase(0.0);
         }
 
         void setPos(int x, int y) {
-            this->x = x;
-            this->y = y;
+            SourceParams& p = table->edit(index);
+            p.x = x;
+            p.y = y;
         }
         SourcePos getPos() {
-            return SourcePos {x, y};
-        }
-        float getPhase() {
-            return phase;
+            return SourcePos {table->get(index).x, table->get(index).y};
         }
         void setPhase(float phase) {
-            this->phase = phase;
-        }
-        float getAmplitude() {
-            return cur_amplitude;
+            SourceParams& p = table->edit(index);
+            p.phase = phase;
+            p.epoch++;
         }
         void setAmplitude(float amp) {
-            this->amplitude = amp;
+            table->edit(index).amplitude = amp;
         }
         float getFreq() {
-            return freq;
+            return table->get(index).freq;
         }
         void setFreq(float freq) {
-            this->freq = freq;
+            table->edit(index).freq = freq;
         }
 
 };
@@ -0,0 +1,126 @@
+#ifndef STILL_CAPTURE_H
+#define STILL_CAPTURE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <vector>
+
+#include "render_target.hpp"
+#include "shader.hpp"
+
+// Largest side of a tile at the supersampled resolution. Bounds the memory of
+// the offscreen target, larger stills are rendered in several tiles.
+#ifndef STILL_MAX_TILE
+#define STILL_MAX_TILE 4096
+#endif
+
+/*
+ * Renders a single frame offscreen at an arbitrary resolution, independent of
+ * the window. Every pixel is rendered supersample x supersample times and box
+ * filtered on the GPU by downsample.glsl. Images larger than a render target
+ * may be split into tiles, each rendered with the part of the projection
+ * which covers it, and assembled in host memory.
+ */
+class StillCapture {
+    int width, height, supersample;
+    int tileWidth, tileHeight; // in output pixels
+    RenderTarget* target;      // one tile at the supersampled resolution
+    unsigned int tileTexture, tileFbo;
+    ComputeShader* downsampleShader;
+    public:
+        StillCapture(int width, int height, int supersample) {
+            this->width = width;
+            this->height = height;
+            this->supersample = std::max(supersample, 1);
+            int maxTile = std::min(RenderTarget::maxSize(), STILL_MAX_TILE) / this->supersample;
+            tileWidth = std::min(width, maxTile);
+            tileHeight = std::min(height, maxTile);
+            target = new RenderTarget(tileWidth * this->supersample, tileHeight * this->supersample);
+
+            glGenTextures(1, &tileTexture);
+            glBindTexture(GL_TEXTURE_2D, tileTexture);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, tileWidth, tileHeight);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glGenFramebuffers(1, &tileFbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, tileFbo);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileTexture, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+            downsampleShader = new ComputeShader("./src/shaders/compute/downsample.glsl");
+            downsampleShader->use();
+            downsampleShader->setInt("factor", this->supersample);
+        }
+        ~StillCapture() {
+            delete target;
+            glDeleteFramebuffers(1, &tileFbo);
+            glDeleteTextures(1, &tileTexture);
+            delete downsampleShader;
+        }
+        StillCapture(const StillCapture&) = delete;
+        StillCapture& operator=(const StillCapture&) = delete;
+
+        bool isComplete() {
+            return tileWidth > 0 && tileHeight > 0 && target->isComplete();
+        }
+
+        // Renders the image tile by tile into rgb, tightly packed RGB rows,
+        // bottom row first. draw(projection) has to clear and draw the scene with
+        // the given projection into the bound framebuffer and viewport.
+        // Leaves the default framebuffer bound, the viewport is not restored.
+        template <class F>
+        void capture(const glm::mat4& projection, F draw, std::vector<unsigned char>& rgb) {
+            rgb.resize((size_t) width * height * 3);
+            int s = supersample;
+            for (int y0 = 0; y0 < height; y0 += tileHeight) {
+                for (int x0 = 0; x0 < width; x0 += tileWidth) {
+                    int w = std::min(tileWidth, width - x0);
+                    int h = std::min(tileHeight, height - y0);
+                    // Maps the tile's part of normalized device coordinates onto all of them.
+                    float left = 2.0f * x0 / width - 1.0f, right = 2.0f * (x0 + w) / width - 1.0f;
+                    float bottom = 2.0f * y0 / height - 1.0f, top = 2.0f * (y0 + h) / height - 1.0f;
+                    glm::mat4 crop = glm::scale(glm::mat4(1.0f), glm::vec3(2.0f / (right - left), 2.0f / (top - bottom), 1.0f));
+                    crop = glm::translate(crop, glm::vec3(-0.5f * (left + right), -0.5f * (bottom + top), 0.0f));
+
+                    target->bind();
+                    glViewport(0, 0, w * s, h * s);
+                    draw(crop * projection);
+
+                    downsampleShader->use();
+                    downsampleShader->setVec2i("size", w, h);
+                    glBindImageTexture(0, target->getColorTexture(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
+                    glBindImageTexture(1, tileTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+                    glDispatchCompute((w + 7) / 8, (h + 7) / 8, 1);
+                    glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+
+                    // Straight into the tile's place in the whole image.
+                    glBindFramebuffer(GL_READ_FRAMEBUFFER, tileFbo);
+                    glReadBuffer(GL_COLOR_ATTACHMENT0);
+                    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+                    glPixelStorei(GL_PACK_ROW_LENGTH, width);
+                    glPixelStorei(GL_PACK_SKIP_PIXELS, x0);
+                    glPixelStorei(GL_PACK_SKIP_ROWS, y0);
+                    glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
+                }
+            }
+            glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+            glPixelStorei(GL_PACK_SKIP_PIXELS, 0);
+            glPixelStorei(GL_PACK_SKIP_ROWS, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        int getWidth() const {
+            return width;
+        }
+        int getHeight() const {
+            return height;
+        }
+        int getSupersample() const {
+            return supersample;
+        }
+        int getTiles() const {
+            return ((width + tileWidth - 1) / tileWidth) * ((height + tileHeight - 1) / tileHeight);
+        }
+};
+#endif
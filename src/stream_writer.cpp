@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "stream_writer.hpp"
+#include "trace.hpp"
+
+// Alignment of buffers, file offsets and sizes for O_DIRECT.
+#define DIRECT_ALIGNMENT 4096
+
+StreamWriter::StreamWriter(const char* path, size_t chunkSize, int chunkCount) {
+    this->chunkSize = (chunkSize + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+    current = -1;
+    fill = 0;
+    closing = false;
+    failed = false;
+    bytesQueued = 0;
+    bytesWritten = 0;
+    stalls = 0;
+    drops = 0;
+
+    direct = true;
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0 && errno == EINVAL) {
+        // The file system does not support O_DIRECT, e.g. tmpfs.
+        direct = false;
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd < 0) {
+        printf("Could not open/create %s: %s\n", path, strerror(errno));
+        failed = true;
+        return;
+    }
+
+    for (int i = 0; i < std::max(chunkCount, 2); i++) {
+        void* memory = NULL;
+        if (posix_memalign(&memory, DIRECT_ALIGNMENT, this->chunkSize) != 0) {
+            printf("Could not allocate the stream writer chunks\n");
+            break;
+        }
+        chunks.push_back((unsigned char*) memory);
+        freeChunks.push_back(i);
+    }
+    thread = std::thread(&StreamWriter::run, this);
+}
+
+StreamWriter::~StreamWriter() {
+    close();
+    for (size_t i = 0; i < chunks.size(); i++) {
+        free(chunks[i]);
+    }
+}
+
+bool StreamWriter::writeChunk(const unsigned char* data, size_t bytes) {
+    // With O_DIRECT a partial last chunk is padded to the alignment, close()
+    // truncates the file to the real size afterwards.
+    size_t size = direct ? (bytes + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT : bytes;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = ::write(fd, data + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EINVAL && direct) {
+            // Some file systems accept O_DIRECT on open but not the write, fall back to buffered writes.
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            direct = false;
+            size = bytes;
+            continue;
+        }
+        if (n <= 0) {
+            printf("Could not write the stream: %s\n", strerror(errno));
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+void StreamWriter::run() {
+    Trace::setThreadName("stream writer");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this] { return !queue.empty() || closing; });
+        if (queue.empty()) {
+            return;
+        }
+        Pending p = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        bool ok;
+        {
+            TRACE_ZONE("write");
+            ok = writeChunk(chunks[p.chunk], p.bytes);
+        }
+        lock.lock();
+        failed = failed || !ok;
+        bytesWritten += p.bytes;
+        freeChunks.push_back(p.chunk);
+        changed.notify_all();
+    }
+}
+
+void StreamWriter::queueCurrent() {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(Pending {current, fill});
+    current = -1;
+    fill = 0;
+    changed.notify_all();
+}
+
+bool StreamWriter::fits(size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return size <= (current >= 0 ? chunkSize - fill : 0) + freeChunks.size() * chunkSize;
+}
+
+bool StreamWriter::write(const void* data, size_t size, bool wait) {
+    if (fd < 0 || chunks.empty()) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failed) {
+            return false;
+        }
+    }
+    // Only the writer thread changes the free space and it only grows it.
+    if (!fits(size)) {
+        if (!wait) {
+            drops++;
+            return false;
+        }
+        stalls++;
+    }
+    const unsigned char* bytes = (const unsigned char*) data;
+    bytesQueued += size;
+    while (size > 0) {
+        if (current < 0) {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return !freeChunks.empty(); });
+            current = freeChunks.back();
+            freeChunks.pop_back();
+        }
+        size_t n = std::min(size, chunkSize - fill);
+        memcpy(chunks[current] + fill, bytes, n);
+        fill += n;
+        bytes += n;
+        size -= n;
+        if (fill == chunkSize) {
+            queueCurrent();
+        }
+    }
+    return true;
+}
+
+bool StreamWriter::close() {
+    if (fd < 0) {
+        return !failed;
+    }
+    if (current >= 0 && fill > 0) {
+        queueCurrent();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+        changed.notify_all();
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+    // Drops the padding of the last chunk.
+    if (ftruncate(fd, bytesWritten) != 0) {
+        printf("Could not truncate the stream: %s\n", strerror(errno));
+        failed = true;
+    }
+    ::close(fd);
+    fd = -1;
+    return !failed;
+}
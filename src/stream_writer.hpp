@@ -0,0 +1,84 @@
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef STREAM_WRITER_H
+#define STREAM_WRITER_H
+
+// Size of a chunk handed to the writer thread. A multiple of the 4 KiB alignment O_DIRECT needs.
+#define STREAM_CHUNK_SIZE (8 << 20)
+#define STREAM_CHUNK_COUNT 4
+
+/*
+ * Writes a stream of bytes, e.g. video frames, to a file on a dedicated thread.
+ * The producer copies into a fixed number of aligned chunks, a full chunk is
+ * queued and written in one piece while the producer fills the next one, so
+ * the memory used stays constant however long the stream gets.
+ * When every chunk is queued the producer either waits for the disk
+ * (back-pressure) or drops the data, see write().
+ * The file is opened with O_DIRECT where supported, bypassing the page cache.
+ */
+class StreamWriter {
+    struct Pending {
+        int chunk;
+        size_t bytes;
+    };
+    int fd;
+    bool direct;
+    size_t chunkSize;
+    std::vector<unsigned char*> chunks;
+    // Owned by the producer: chunk being filled (-1 for none) and its fill level.
+    int current;
+    size_t fill;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Pending> queue; // chunks waiting to be written, oldest first
+    std::vector<int> freeChunks;
+    bool closing;
+    bool failed;
+    std::thread thread;
+
+    long long bytesQueued, bytesWritten;
+    long stalls, drops;
+
+    void run();
+    bool writeChunk(const unsigned char* data, size_t bytes);
+    void queueCurrent();
+    public:
+        StreamWriter(const char* path, size_t chunkSize = STREAM_CHUNK_SIZE, int chunkCount = STREAM_CHUNK_COUNT);
+        ~StreamWriter();
+        StreamWriter(const StreamWriter&) = delete;
+        StreamWriter& operator=(const StreamWriter&) = delete;
+
+        bool isOpen() const {
+            return fd >= 0;
+        }
+        // Appends size bytes. If all chunks are queued this waits until one was
+        // written, unless wait is false: then nothing is appended and false is returned
+        // when the data does not fit into the free chunks. Also false after a write error.
+        bool write(const void* data, size_t size, bool wait = true);
+        // Whether size bytes can be appended right now without waiting.
+        bool fits(size_t size);
+        // Writes everything appended so far and closes the file. Returns false after a
+        // write error. Closing again only reports the result.
+        bool close();
+
+        long long getBytesWritten() const {
+            return bytesQueued;
+        }
+        // Number of writes which had to wait for the disk, and which were dropped instead.
+        long getStalls() const {
+            return stalls;
+        }
+        long getDrops() const {
+            return drops;
+        }
+        bool isDirect() const {
+            return direct;
+        }
+};
+#endif
@@ -0,0 +1,110 @@
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "thread_pool.hpp"
+
+static void pinToCpu(int thread) {
+    // Picks among the CPUs the thread may run on, which taskset or a cpuset may
+    // restrict. A new thread starts with the affinity of the thread creating it.
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+    int index = thread % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && index-- == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            return;
+        }
+    }
+#else
+    (void) thread;
+#endif
+}
+
+ThreadPool::ThreadPool(int threads) {
+    threadCount = std::max(1, threads);
+    job = NULL;
+    jobGeneration = 0;
+    finished = 0;
+    stopping = false;
+    arrived = 0;
+    barrierGeneration = 0;
+    for (int i = 1; i < threadCount; i++) {
+        workers.push_back(std::thread(&ThreadPool::work, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+void ThreadPool::work(int thread) {
+    pinToCpu(thread);
+    long seen = 0;
+    while (true) {
+        const std::function<void(int)>* current;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || jobGeneration != seen; });
+            if (stopping) return;
+            seen = jobGeneration;
+            current = job;
+        }
+        (*current)(thread);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished++;
+        }
+        done.notify_one();
+    }
+}
+
+void ThreadPool::run(const std::function<void(int)>& job) {
+    if (threadCount == 1) {
+        job(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->job = &job;
+        finished = 0;
+        jobGeneration++;
+    }
+    wake.notify_all();
+    job(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return finished == threadCount - 1; });
+}
+
+void ThreadPool::barrier() {
+    if (threadCount == 1) {
+        return;
+    }
+    int generation = barrierGeneration.load(std::memory_order_acquire);
+    if (arrived.fetch_add(1, std::memory_order_acq_rel) == threadCount - 1) {
+        arrived.store(0, std::memory_order_relaxed);
+        barrierGeneration.fetch_add(1, std::memory_order_release);
+        return;
+    }
+    // Spin for a short while, the other threads are usually close behind.
+    // Yield afterwards in case there are more threads than cores.
+    for (int spins = 0; barrierGeneration.load(std::memory_order_acquire) == generation; spins++) {
+        if (spins > 1000) {
+            std::this_thread::yield();
+        }
+    }
+}
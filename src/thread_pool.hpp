@@ -0,0 +1,52 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/*
+ * Fixed set of threads which is created once and reused for every job.
+ * A job runs on all threads at once, the calling thread taking part as thread 0,
+ * and may synchronize its threads with barrier().
+ * Worker threads are pinned to consecutive CPUs of the process affinity mask,
+ * so memory first touched by a worker stays on its NUMA node. The calling
+ * thread is left unpinned, threads it creates later would inherit its affinity,
+ * so the memory it touches for thread 0 may land on any node.
+ */
+class ThreadPool {
+    std::vector<std::thread> workers;
+    int threadCount;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int)>* job;
+    long jobGeneration;
+    int finished;
+    bool stopping;
+
+    std::atomic<int> arrived;
+    std::atomic<int> barrierGeneration;
+
+    void work(int thread);
+    public:
+        // threads includes the calling thread.
+        ThreadPool(int threads);
+        ~ThreadPool();
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        int size() const {
+            return threadCount;
+        }
+        // Runs job(thread) on every thread and returns once all of them finished.
+        void run(const std::function<void(int)>& job);
+        // Blocks until every thread of the running job arrived. Only valid inside run().
+        void barrier();
+};
+#endif
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "trace.hpp"
+
+struct TraceEvent {
+    const char* name;
+    int64_t start, end;
+};
+
+// Ring of the events of one thread. Only the owning thread writes it, count is
+// published after the event, so a reader sees every event below count complete
+// unless the thread went once round the ring meanwhile.
+struct TraceBuffer {
+    std::vector<TraceEvent> events;
+    std::atomic<size_t> count;
+    int track;
+    std::string name;
+};
+
+static std::mutex buffersMutex;
+static std::vector<TraceBuffer*> buffers; // kept until exit, threads may still hold them
+static size_t capacity = 1 << 16;
+static int64_t origin = 0;
+static TraceBuffer* gpuBuffer = NULL;
+static thread_local TraceBuffer* localBuffer = NULL;
+static thread_local const char* localName = NULL;
+
+// Called with buffersMutex held.
+static TraceBuffer* createBuffer(const char* name) {
+    TraceBuffer* b = new TraceBuffer();
+    b->events.resize(capacity);
+    b->count.store(0);
+    b->track = buffers.size() + 1;
+    b->name = name;
+    buffers.push_back(b);
+    return b;
+}
+
+static TraceBuffer* threadBuffer() {
+    if (localBuffer == NULL) {
+        // Once per thread, every later event goes without a lock.
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        char name[32];
+        if (localName == NULL) {
+            snprintf(name, sizeof(name), "thread %d", (int) buffers.size() + 1);
+        }
+        localBuffer = createBuffer(localName != NULL ? localName : name);
+    }
+    return localBuffer;
+}
+
+static void push(TraceBuffer* b, const char* name, int64_t start, int64_t end) {
+    size_t n = b->count.load(std::memory_order_relaxed);
+    TraceEvent& e = b->events[n % b->events.size()];
+    e.name = name;
+    e.start = start;
+    e.end = end;
+    b->count.store(n + 1, std::memory_order_release);
+}
+
+std::atomic<bool> Trace::active(false);
+
+void Trace::start(size_t eventsPerThread) {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    // Threads which recorded before keep their rings.
+    capacity = eventsPerThread > 0 ? eventsPerThread : 1;
+    if (origin == 0) {
+        origin = now();
+    }
+    if (gpuBuffer == NULL) {
+        gpuBuffer = createBuffer("GPU");
+    }
+    active.store(true);
+}
+
+void Trace::stop() {
+    active.store(false);
+}
+
+void Trace::record(const char* name, int64_t start, int64_t end) {
+    push(threadBuffer(), name, start, end);
+}
+
+void Trace::recordGpu(const char* name, int64_t start, int64_t end) {
+    if (gpuBuffer != NULL) {
+        push(gpuBuffer, name, start, end);
+    }
+}
+
+void Trace::setThreadName(const char* name) {
+    localName = name;
+    if (localBuffer != NULL) {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        localBuffer->name = name;
+    }
+}
+
+bool Trace::write(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Could not open %s for writing\n", path);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"wave\"}}");
+    long written = 0;
+    for (size_t i = 0; i < buffers.size(); i++) {
+        TraceBuffer* b = buffers[i];
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                b->track, b->name.c_str());
+        fprintf(file, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}",
+                b->track, b == gpuBuffer ? 1000 : b->track);
+
+        size_t size = b->events.size();
+        size_t end = b->count.load(std::memory_order_acquire);
+        size_t first = end > size ? end - size : 0;
+        std::vector<TraceEvent> copy(end - first);
+        for (size_t n = first; n < end; n++) {
+            copy[n - first] = b->events[n % size];
+        }
+        // Events the thread overwrote while they were copied are left out, including
+        // the slot of event later, which may be in the middle of being written.
+        size_t later = b->count.load(std::memory_order_acquire);
+        size_t valid = later + 1 > size ? later + 1 - size : 0;
+        for (size_t n = std::max(first, valid); n < end; n++) {
+            const TraceEvent& e = copy[n - first];
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    e.name, b == gpuBuffer ? "gpu" : "cpu", b->track,
+                    1.0e-3 * (e.start - origin), 1.0e-3 * (e.end - e.start));
+            written++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    bool ok = ferror(file) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (ok) {
+        printf("Wrote %ld trace events to %s\n", written, path);
+    } else {
+        printf("Could not write %s\n", path);
+    }
+    return ok;
+}
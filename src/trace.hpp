@@ -0,0 +1,65 @@
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Timeline of named scopes on every thread and of the GPU passes, written as
+ * Chrome trace event JSON, which chrome://tracing and ui.perfetto.dev open.
+ * Every thread records into a ring of its own without locks, so a zone costs
+ * two clock reads while tracing and a single flag test otherwise. The rings
+ * keep the latest events, so the trace shows the time right before it is
+ * written. Building with -DNO_TRACE removes the zones altogether.
+ */
+class Trace {
+    static std::atomic<bool> active;
+    public:
+        // Starts recording, every thread keeps its last eventsPerThread events.
+        static void start(size_t eventsPerThread = 1 << 16);
+        static void stop();
+        static bool enabled() {
+            return active.load(std::memory_order_relaxed);
+        }
+        // Writes everything recorded so far. Events recorded meanwhile may be left out.
+        static bool write(const char* path);
+
+        // Nanoseconds on CLOCK_MONOTONIC, the clock of every event.
+        static int64_t now() {
+            struct timespec t;
+            clock_gettime(CLOCK_MONOTONIC, &t);
+            return (int64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+        }
+        // name has to outlive the trace, e.g. a string literal.
+        static void record(const char* name, int64_t start, int64_t end);
+        // Records a pass on the track of the GPU, from the thread owning the context.
+        static void recordGpu(const char* name, int64_t start, int64_t end);
+        // Names the calling thread's track.
+        static void setThreadName(const char* name);
+};
+
+// Records the enclosing scope while tracing.
+class TraceZone {
+    const char* name;
+    int64_t start;
+    public:
+        TraceZone(const char* name) {
+            this->name = name;
+            start = Trace::enabled() ? Trace::now() : 0;
+        }
+        ~TraceZone() {
+            if (start != 0) Trace::record(name, start, Trace::now());
+        }
+        TraceZone(const TraceZone&) = delete;
+        TraceZone& operator=(const TraceZone&) = delete;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#ifdef NO_TRACE
+#define TRACE_ZONE(name)
+#else
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#endif
+#endif
@@ -0,0 +1,159 @@
+#ifndef VIDEO_STREAM_H
+#define VIDEO_STREAM_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <string>
+
+#include "frame_capture.hpp"
+#include "image_encoder.hpp"
+#include "stream_writer.hpp"
+
+// Container written by a VideoStream.
+enum VideoFormat {
+    VIDEO_Y4M, // YUV4MPEG2, I420 in BT.601 limited range
+    VIDEO_PPM, // concatenated binary PPM images, RGB24
+    VIDEO_PNG, // directory of numbered PNG images
+    VIDEO_QOI  // directory of numbered QOI images
+};
+
+/*
+ * Self-describing video file, so encoders can read it from a pipe as is:
+ *   ffmpeg -i FILE.y4m out.mp4
+ *   ffmpeg -f image2pipe -c:v ppm -r 60 -i FILE.ppm out.mp4
+ * A YUV4MPEG2 stream states size and frame rate once in its header and every
+ * frame has to match. A PPM stream has a header per frame and may change size.
+ * Image sequences are written as DIR/000000.png and so on by an ImageEncoder:
+ *   ffmpeg -framerate 60 -i DIR/%06d.png out.mp4
+ * Frames are expected top row first in the layout of captureFormat().
+ */
+class VideoStream {
+    StreamWriter* writer;   // NULL for image sequences
+    ImageEncoder* encoder;  // NULL for video files
+    std::string path;
+    VideoFormat format;
+    int width, height, fps;
+    long frames, dropped;
+    public:
+        // The encoder settings only apply to image sequences.
+        VideoStream(const char* path, VideoFormat format, int width, int height, int fps, int encodeWorkers = 1, int encodeQueue = 2) {
+            this->path = path;
+            this->format = format;
+            this->width = width;
+            this->height = height;
+            this->fps = fps;
+            frames = 0;
+            dropped = 0;
+            writer = NULL;
+            encoder = NULL;
+            if (isImageSequence(format)) {
+                if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+                    printf("Could not create %s: %s\n", path, strerror(errno));
+                    return;
+                }
+                encoder = new ImageEncoder(format == VIDEO_PNG ? IMAGE_PNG : IMAGE_QOI, encodeWorkers, encodeQueue);
+                return;
+            }
+            writer = new StreamWriter(path);
+            if (format == VIDEO_Y4M) {
+                char header[128];
+                int n = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+                        width, height, fps);
+                writer->write(header, n);
+            }
+        }
+        ~VideoStream() {
+            delete writer;
+            delete encoder;
+        }
+        VideoStream(const VideoStream&) = delete;
+        VideoStream& operator=(const VideoStream&) = delete;
+
+        bool isOpen() const {
+            return writer != NULL ? writer->isOpen() : encoder != NULL;
+        }
+        static bool isImageSequence(VideoFormat format) {
+            return format == VIDEO_PNG || format == VIDEO_QOI;
+        }
+        // File extension, or an empty string for image sequences which are written to a directory.
+        static const char* extension(VideoFormat format) {
+            return format == VIDEO_Y4M ? "y4m" : format == VIDEO_PPM ? "ppm" : "";
+        }
+        static CaptureFormat captureFormat(VideoFormat format) {
+            return format == VIDEO_Y4M ? CAPTURE_YUV420 : CAPTURE_RGB;
+        }
+        // Whether frames of the given size can go into the stream.
+        bool accepts(int width, int height) const {
+            return format != VIDEO_Y4M || (width == this->width && height == this->height);
+        }
+
+        // Appends a frame of size bytes with its header. Without wait the frame is
+        // dropped as a whole when the writer or the encoder is behind.
+        bool writeFrame(int width, int height, const unsigned char* pixels, size_t size, bool wait) {
+            if (!accepts(width, height)) {
+                dropped++;
+                return false;
+            }
+            if (encoder != NULL) {
+                char name[32];
+                snprintf(name, sizeof(name), "/%06ld.%s", frames, ImageEncoder::extension(encoder->getFormat()));
+                if (!encoder->submit(path + name, width, height, pixels, false, wait)) {
+                    dropped++;
+                    return false;
+                }
+                frames++;
+                return true;
+            }
+            char header[64];
+            int n = format == VIDEO_Y4M
+                ? snprintf(header, sizeof(header), "FRAME\n")
+                : snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+            if (!wait && !writer->fits(n + size)) {
+                dropped++;
+                return false;
+            }
+            if (!writer->write(header, n) || !writer->write(pixels, size)) {
+                return false;
+            }
+            frames++;
+            return true;
+        }
+
+        // Writes everything queued so far. Returns false if anything could not be written.
+        bool close() {
+            if (encoder != NULL) {
+                encoder->finish();
+                return encoder->getFailed() == 0;
+            }
+            return writer != NULL && writer->close();
+        }
+
+        // The writer of a video file or the encoder of an image sequence, the other one is NULL.
+        const StreamWriter* getWriter() const {
+            return writer;
+        }
+        const ImageEncoder* getEncoder() const {
+            return encoder;
+        }
+        const std::string& getPath() const {
+            return path;
+        }
+        long getFrames() const {
+            return frames;
+        }
+        long getDropped() const {
+            return dropped;
+        }
+        int getWidth() const {
+            return width;
+        }
+        int getHeight() const {
+            return height;
+        }
+        int getFps() const {
+            return fps;
+        }
+};
+#endif
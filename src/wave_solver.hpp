@@ -0,0 +1,66 @@
+#include <stddef.h>
+#include <vector>
+
+#include "source.hpp"
+
+#ifndef WAVE_SOLVER_H
+#define WAVE_SOLVER_H
+
+/*
+ * Interface of the solver backends, GpuSolver and CpuSolver.
+ * A solver owns two time levels of a width x height grid surrounded by padding
+ * cells which stay zero and form the boundary, and the state of the sources.
+ * The source parameters are read from the table passed to step().
+ * Heights are exchanged as stride x rows floats, padding included, like the
+ * textures the wave shader samples.
+ */
+class WaveSolver {
+    protected:
+        int width, height, padding;
+        int stride; // floats per row, including the padding
+
+        WaveSolver(int width, int height, int padding) {
+            this->width = width;
+            this->height = height;
+            this->padding = padding;
+            stride = width + 2 * padding;
+        }
+    public:
+        virtual ~WaveSolver() {}
+
+        virtual const char* name() const = 0;
+        // Advances by the given number of steps, injecting the sources of the table.
+        virtual void step(int steps, float delta, float damping, SourceTable& sources) = 0;
+        // Zeroes the heights and the source state.
+        virtual void reset() = 0;
+        // Copies the latest or the previous heights into out.
+        virtual void readHeights(bool latest, std::vector<float>& out) = 0;
+
+        // Texture holding the latest or the previous heights, 0 if they live in host memory.
+        virtual unsigned int heightTexture(bool latest) const {
+            (void) latest;
+            return 0;
+        }
+        // The latest or the previous heights in host memory, NULL if they live on the GPU.
+        virtual const float* hostHeights(bool latest) const {
+            (void) latest;
+            return NULL;
+        }
+
+        int getWidth() const {
+            return width;
+        }
+        int getHeight() const {
+            return height;
+        }
+        int getPadding() const {
+            return padding;
+        }
+        int getStride() const {
+            return stride;
+        }
+        int getRows() const {
+            return height + 2 * padding;
+        }
+};
+#endif